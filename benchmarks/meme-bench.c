@@ -0,0 +1,501 @@
+/* Rendering benchmarks, run by `meson test --benchmark` (one suite per
+ * benchmark) or by hand:
+ *
+ *   memerist-bench composite --sizes 1,12 --output composite.json
+ *
+ * Each case is run once to warm the caches the app keeps between frames
+ * (converted rasters, text shapes, the tile pool), then timed until it has
+ * both --min-samples samples and --min-time seconds, or --max-samples.
+ * Calls much faster than a millisecond are batched so one sample covers
+ * several, and every figure is per call. The report is JSON on stdout: the
+ * median and 99th percentile in milliseconds and the heap allocations made
+ * per call, counted where the C library lets us (glibc). */
+
+#include "config.h"
+#include "meme-renderer.h"
+#include "meme-filters.h"
+#include <json-glib/json-glib.h>
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef __GLIBC__
+/* The executable's own malloc interposes the C library's for every shared
+ * object loaded, cairo and pixman included; these are the originals. */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static guint64 alloc_count;
+
+void * malloc (size_t size) {
+  __atomic_add_fetch (&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_malloc (size);
+}
+
+void * calloc (size_t n, size_t size) {
+  __atomic_add_fetch (&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_calloc (n, size);
+}
+
+void * realloc (void *ptr, size_t size) {
+  __atomic_add_fetch (&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_realloc (ptr, size);
+}
+
+static guint64 allocations (void) {
+  return __atomic_load_n (&alloc_count, __ATOMIC_RELAXED);
+}
+#define ALLOCATIONS_COUNTED TRUE
+#else
+static guint64 allocations (void) {
+  return 0;
+}
+#define ALLOCATIONS_COUNTED FALSE
+#endif
+
+#define BENCH_SEED        0x5eed
+#define BENCH_TARGET_US   1000  /* shortest sample worth timing */
+#define BENCH_VIEWPORT_W  1920
+#define BENCH_VIEWPORT_H  1080
+
+static const int default_sizes[] = { 1, 4, 12, 24, 48 };
+static const int layer_counts[] = { 0, 4, 16 };
+
+static char *opt_sizes;
+static int opt_min_samples = 10;
+static int opt_max_samples = 200;
+static double opt_min_time = 1.0;
+static char *opt_output;
+
+typedef void (*BenchFunc) (gpointer data);
+
+typedef struct {
+  guint n_samples;
+  guint per_sample;
+  double median_ms;
+  double p99_ms;
+  double allocations;
+} BenchStats;
+
+static int compare_doubles (gconstpointer a, gconstpointer b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench_run (BenchFunc func, gpointer data, BenchStats *stats) {
+  GArray *samples = g_array_new (FALSE, FALSE, sizeof (double));
+  gint64 start, elapsed, begin;
+  guint64 allocs = 0, before;
+  guint i;
+
+  start = g_get_monotonic_time ();
+  func (data);
+  elapsed = g_get_monotonic_time () - start;
+  stats->per_sample = elapsed >= BENCH_TARGET_US ? 1 : (guint)(BENCH_TARGET_US / MAX (elapsed, 1)) + 1;
+
+  begin = g_get_monotonic_time ();
+  while ((int)samples->len < opt_max_samples &&
+         ((int)samples->len < opt_min_samples || g_get_monotonic_time () - begin < opt_min_time * G_USEC_PER_SEC)) {
+    double ms;
+    before = allocations ();
+    start = g_get_monotonic_time ();
+    for (i = 0; i < stats->per_sample; i++) func (data);
+    elapsed = g_get_monotonic_time () - start;
+    allocs += allocations () - before;
+    ms = elapsed / 1000.0 / stats->per_sample;
+    g_array_append_val (samples, ms);
+  }
+
+  g_array_sort (samples, compare_doubles);
+  stats->n_samples = samples->len;
+  stats->median_ms = samples->len % 2 ? g_array_index (samples, double, samples->len / 2)
+                                      : (g_array_index (samples, double, samples->len / 2 - 1) +
+                                         g_array_index (samples, double, samples->len / 2)) / 2.0;
+  stats->p99_ms = g_array_index (samples, double, (guint)ceil (samples->len * 0.99) - 1);
+  stats->allocations = (double)allocs / ((double)samples->len * stats->per_sample);
+  g_array_unref (samples);
+}
+
+/* 4:3, like most photos, at @megapixels million pixels. */
+static void size_for_megapixels (int megapixels, int *width, int *height) {
+  *width = (int)round (sqrt (megapixels * 1e6 * 4.0 / 3.0));
+  *height = (int)round (megapixels * 1e6 / *width);
+}
+
+/* Smooth gradients with hashed grain, so neither the filters nor the
+ * samplers see flat colour. The same size always gives the same pixels. */
+static GdkPixbuf * bench_image (int width, int height, gboolean alpha) {
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, alpha, 8, width, height);
+  int n = alpha ? 4 : 3, stride = gdk_pixbuf_get_rowstride (pixbuf), x, y;
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+
+  for (y = 0; y < height; y++) {
+    guchar *p = pixels + (gsize)y * stride;
+    for (x = 0; x < width; x++, p += n) {
+      guint32 h = ((guint32)x * 73856093u) ^ ((guint32)y * 19349663u);
+      h ^= h >> 13;
+      h *= 0x5bd1e995u;
+      p[0] = (guchar)(x * 255 / width) ^ (h & 0x1f);
+      p[1] = (guchar)(y * 255 / height) ^ ((h >> 8) & 0x1f);
+      p[2] = (guchar)((x + y) * 255 / (width + height)) ^ ((h >> 16) & 0x1f);
+      if (alpha) p[3] = (x - width / 2) * (x - width / 2) + (y - height / 2) * (y - height / 2) <
+                        (width / 2) * (width / 2) ? 255 : 0;
+    }
+  }
+  return pixbuf;
+}
+
+/* Captions and stickers in turn, spread over the image and sized to it the
+ * way a user would, so the layer cost scales with the template. */
+static MemeLayerStack * bench_layers (int count, int width, int height, GdkPixbuf *sticker) {
+  MemeLayerStack *layers = meme_layer_stack_new ();
+  int i;
+
+  for (i = 0; i < count; i++) {
+    ImageLayer layer = { 0 };
+    if (i % 2 == 0) {
+      char *text = g_strdup_printf ("WHEN THE BENCHMARK RUNS %d", i);
+      layer.content.type = LAYER_TYPE_TEXT;
+      layer.content.text = g_ref_string_new (text);
+      layer.content.font_size = width / 16.0;
+      g_free (text);
+    } else {
+      layer.content.type = LAYER_TYPE_IMAGE;
+      layer.content.pixbuf = g_object_ref (sticker);
+      layer.geometry.width = gdk_pixbuf_get_width (sticker);
+      layer.geometry.height = gdk_pixbuf_get_height (sticker);
+    }
+    layer.geometry.x = (i % 4 + 0.5) / 4.0;
+    layer.geometry.y = ((i / 4) % 4 + 0.5) / 4.0;
+    layer.geometry.scale = i % 2 ? MIN (width, height) / 4.0 / gdk_pixbuf_get_width (sticker) : 1.0;
+    layer.geometry.rotation = (i % 3 - 1) * 0.2;
+    layer.content.opacity = i % 5 == 4 ? 0.7 : 1.0;
+    layer.content.blend_mode = (BlendMode)(i % 4);
+    meme_layer_layout (&layer.geometry, &layer.content);
+    meme_layer_stack_insert (layers, -1, &layer);
+  }
+  return layers;
+}
+
+static JsonBuilder * begin_result (JsonBuilder *builder, const char *function, int megapixels, int width, int height) {
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "function");
+  json_builder_add_string_value (builder, function);
+  json_builder_set_member_name (builder, "megapixels");
+  json_builder_add_int_value (builder, megapixels);
+  json_builder_set_member_name (builder, "width");
+  json_builder_add_int_value (builder, width);
+  json_builder_set_member_name (builder, "height");
+  json_builder_add_int_value (builder, height);
+  return builder;
+}
+
+static void end_result (JsonBuilder *builder, const BenchStats *stats) {
+  json_builder_set_member_name (builder, "samples");
+  json_builder_add_int_value (builder, stats->n_samples);
+  json_builder_set_member_name (builder, "calls_per_sample");
+  json_builder_add_int_value (builder, stats->per_sample);
+  json_builder_set_member_name (builder, "median_ms");
+  json_builder_add_double_value (builder, stats->median_ms);
+  json_builder_set_member_name (builder, "p99_ms");
+  json_builder_add_double_value (builder, stats->p99_ms);
+  json_builder_set_member_name (builder, "allocations");
+  if (ALLOCATIONS_COUNTED) json_builder_add_double_value (builder, stats->allocations);
+  else json_builder_add_null_value (builder);
+  json_builder_end_object (builder);
+}
+
+/* composite: meme_render_composite () over sizes x layer counts x filters. */
+
+typedef struct {
+  GdkPixbuf *bg;
+  MemeLayerStack *layers;
+  gboolean cinematic;
+  gboolean deep_fry;
+} CompositeCase;
+
+static void composite_call (gpointer data) {
+  CompositeCase *c = (CompositeCase *)data;
+  cairo_surface_destroy (meme_render_composite (c->bg, NULL, c->layers, NULL, c->cinematic, c->deep_fry, BENCH_SEED, NULL));
+}
+
+static void suite_composite (JsonBuilder *builder, GArray *sizes) {
+  GdkPixbuf *sticker = bench_image (512, 512, TRUE);
+  guint s, l;
+  int f;
+
+  for (s = 0; s < sizes->len; s++) {
+    int mp = g_array_index (sizes, int, s), w, h;
+    CompositeCase c = { 0 };
+
+    size_for_megapixels (mp, &w, &h);
+    c.bg = bench_image (w, h, FALSE);
+    for (l = 0; l < G_N_ELEMENTS (layer_counts); l++) {
+      c.layers = bench_layers (layer_counts[l], w, h, sticker);
+      for (f = 0; f < 4; f++) {
+        BenchStats stats;
+        c.cinematic = f & 1;
+        c.deep_fry = f & 2;
+        bench_run (composite_call, &c, &stats);
+        begin_result (builder, "meme_render_composite", mp, w, h);
+        json_builder_set_member_name (builder, "layers");
+        json_builder_add_int_value (builder, layer_counts[l]);
+        json_builder_set_member_name (builder, "cinematic");
+        json_builder_add_boolean_value (builder, c.cinematic);
+        json_builder_set_member_name (builder, "deep_fry");
+        json_builder_add_boolean_value (builder, c.deep_fry);
+        end_result (builder, &stats);
+      }
+      meme_layer_stack_free (c.layers);
+    }
+    g_object_unref (c.bg);
+  }
+  g_object_unref (sticker);
+}
+
+/* filters: the post-process on a cairo surface, in place, as the compositor
+ * and export run it: the kernel on one thread, then spread over the tile
+ * pool. Repeated passes drift the pixels, which costs the same. */
+
+typedef struct {
+  cairo_surface_t *surface;
+  gboolean cinematic;
+  gboolean deep_fry;
+} FilterCase;
+
+static void filter_kernel_call (gpointer data) {
+  FilterCase *c = (FilterCase *)data;
+  cairo_surface_flush (c->surface);
+  meme_filter_post_process (cairo_image_surface_get_data (c->surface),
+                            cairo_image_surface_get_width (c->surface), cairo_image_surface_get_height (c->surface),
+                            cairo_image_surface_get_stride (c->surface), MEME_PIXELS_CAIRO,
+                            0, 0, 1.0, 1.0, c->cinematic, c->deep_fry, BENCH_SEED);
+  cairo_surface_mark_dirty (c->surface);
+}
+
+static void filter_tiled_call (gpointer data) {
+  FilterCase *c = (FilterCase *)data;
+  meme_render_post_process (c->surface, NULL, 1.0, 1.0, c->cinematic, c->deep_fry, BENCH_SEED);
+}
+
+static void suite_filters (JsonBuilder *builder, GArray *sizes) {
+  static const struct { const char *name; void (*call) (gpointer); } paths[] = {
+    { "meme_filter_post_process", filter_kernel_call },
+    { "meme_render_post_process", filter_tiled_call },
+  };
+  guint s, p;
+  int f;
+
+  for (s = 0; s < sizes->len; s++) {
+    int mp = g_array_index (sizes, int, s), w, h;
+    FilterCase c = { 0 };
+    cairo_t *cr;
+    GdkPixbuf *image;
+
+    size_for_megapixels (mp, &w, &h);
+    image = bench_image (w, h, FALSE);
+    c.surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, w, h);
+    cr = cairo_create (c.surface);
+    gdk_cairo_set_source_pixbuf (cr, image, 0, 0);
+    cairo_paint (cr);
+    cairo_destroy (cr);
+    g_object_unref (image);
+
+    for (p = 0; p < G_N_ELEMENTS (paths); p++) {
+      for (f = 1; f < 4; f++) {
+        BenchStats stats;
+        c.cinematic = f & 1;
+        c.deep_fry = f & 2;
+        bench_run (paths[p].call, &c, &stats);
+        begin_result (builder, paths[p].name, mp, w, h);
+        json_builder_set_member_name (builder, "cinematic");
+        json_builder_add_boolean_value (builder, c.cinematic);
+        json_builder_set_member_name (builder, "deep_fry");
+        json_builder_add_boolean_value (builder, c.deep_fry);
+        end_result (builder, &stats);
+      }
+    }
+    cairo_surface_destroy (c.surface);
+  }
+}
+
+/* overlay: meme_render_editor_overlay () onto a full-HD viewport, fitted
+ * the way the canvas fits the document. */
+
+typedef struct {
+  cairo_surface_t *viewport;
+  double width;
+  double height;
+  const LayerGeometry *selection;
+  gboolean crop;
+} OverlayCase;
+
+static void overlay_call (gpointer data) {
+  OverlayCase *c = (OverlayCase *)data;
+  double scale = MIN (BENCH_VIEWPORT_W / c->width, BENCH_VIEWPORT_H / c->height);
+  cairo_t *cr = cairo_create (c->viewport);
+
+  cairo_translate (cr, (BENCH_VIEWPORT_W - c->width * scale) / 2.0, (BENCH_VIEWPORT_H - c->height * scale) / 2.0);
+  cairo_scale (cr, scale, scale);
+  meme_render_editor_overlay (cr, c->width, c->height, c->selection, c->crop, 0.1, 0.1, 0.8, 0.8, 1.0 / scale);
+  cairo_destroy (cr);
+  cairo_surface_flush (c->viewport);
+}
+
+static void suite_overlay (JsonBuilder *builder, GArray *sizes) {
+  static const char *modes[] = { "selection", "crop", "both" };
+  GdkPixbuf *sticker = bench_image (512, 512, TRUE);
+  OverlayCase c = { 0 };
+  guint s;
+  int m;
+
+  c.viewport = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, BENCH_VIEWPORT_W, BENCH_VIEWPORT_H);
+  for (s = 0; s < sizes->len; s++) {
+    int mp = g_array_index (sizes, int, s), w, h;
+    MemeLayerStack *layers;
+
+    size_for_megapixels (mp, &w, &h);
+    c.width = w;
+    c.height = h;
+    layers = bench_layers (2, w, h, sticker);
+    for (m = 0; m < (int)G_N_ELEMENTS (modes); m++) {
+      BenchStats stats;
+      c.selection = m != 1 ? meme_layer_stack_get_geometry (layers, 1) : NULL;
+      c.crop = m != 0;
+      bench_run (overlay_call, &c, &stats);
+      begin_result (builder, "meme_render_editor_overlay", mp, w, h);
+      json_builder_set_member_name (builder, "mode");
+      json_builder_add_string_value (builder, modes[m]);
+      end_result (builder, &stats);
+    }
+    meme_layer_stack_free (layers);
+  }
+  cairo_surface_destroy (c.viewport);
+  g_object_unref (sticker);
+}
+
+typedef struct {
+  const char *name;
+  void (*run) (JsonBuilder *builder, GArray *sizes);
+} BenchSuite;
+
+static const BenchSuite suites[] = {
+  { "composite", suite_composite },
+  { "filters", suite_filters },
+  { "overlay", suite_overlay },
+};
+
+static GArray * parse_sizes (const char *list, GError **error) {
+  GArray *sizes = g_array_new (FALSE, FALSE, sizeof (int));
+  char **parts;
+  int i;
+
+  if (!list) {
+    g_array_append_vals (sizes, default_sizes, G_N_ELEMENTS (default_sizes));
+    return sizes;
+  }
+  parts = g_strsplit (list, ",", -1);
+  for (i = 0; parts[i]; i++) {
+    gint64 value;
+    int mp;
+    if (!g_ascii_string_to_signed (g_strstrip (parts[i]), 10, 1, 100, &value, error)) {
+      g_prefix_error (error, "--sizes: ");
+      g_array_unref (sizes);
+      sizes = NULL;
+      break;
+    }
+    mp = (int)value;
+    g_array_append_val (sizes, mp);
+  }
+  g_strfreev (parts);
+  return sizes;
+}
+
+int main (int argc, char *argv[]) {
+  const GOptionEntry entries[] = {
+    { "sizes", 0, 0, G_OPTION_ARG_STRING, &opt_sizes, "Image sizes in megapixels (default 1,4,12,24,48)", "MP,..." },
+    { "min-samples", 0, 0, G_OPTION_ARG_INT, &opt_min_samples, "Fewest samples per case (default 10)", "N" },
+    { "max-samples", 0, 0, G_OPTION_ARG_INT, &opt_max_samples, "Most samples per case (default 200)", "N" },
+    { "min-time", 0, 0, G_OPTION_ARG_DOUBLE, &opt_min_time, "Seconds to keep sampling each case (default 1)", "SECONDS" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Write the report here instead of stdout", "FILE" },
+    { NULL }
+  };
+  GOptionContext *context = g_option_context_new ("[composite|filters|overlay]...");
+  JsonBuilder *builder;
+  JsonGenerator *generator;
+  JsonNode *root;
+  GArray *sizes;
+  GError *error = NULL;
+  gboolean ok = TRUE;
+  guint i;
+  int a;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_set_summary (context, "Times the rendering core and prints the results as JSON.\n"
+                                         "Without a suite name, every suite runs.");
+  if (!g_option_context_parse (context, &argc, &argv, &error) ||
+      !(sizes = parse_sizes (opt_sizes, &error))) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 2;
+  }
+  g_option_context_free (context);
+  for (a = 1; a < argc; a++) {
+    gboolean known = FALSE;
+    for (i = 0; i < G_N_ELEMENTS (suites); i++) known |= g_strcmp0 (argv[a], suites[i].name) == 0;
+    if (!known) {
+      g_printerr ("Unknown suite “%s”\n", argv[a]);
+      g_array_unref (sizes);
+      return 2;
+    }
+  }
+  opt_min_samples = MAX (opt_min_samples, 1);
+  opt_max_samples = MAX (opt_max_samples, opt_min_samples);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "version");
+  json_builder_add_string_value (builder, PACKAGE_VERSION);
+  json_builder_set_member_name (builder, "allocations_counted");
+  json_builder_add_boolean_value (builder, ALLOCATIONS_COUNTED);
+  json_builder_set_member_name (builder, "threads");
+  json_builder_add_int_value (builder, g_get_num_processors ());
+  json_builder_set_member_name (builder, "suites");
+  json_builder_begin_object (builder);
+  for (i = 0; i < G_N_ELEMENTS (suites); i++) {
+    gboolean wanted = argc < 2;
+    for (a = 1; a < argc; a++) wanted |= g_strcmp0 (argv[a], suites[i].name) == 0;
+    if (!wanted) continue;
+    json_builder_set_member_name (builder, suites[i].name);
+    json_builder_begin_array (builder);
+    suites[i].run (builder, sizes);
+    json_builder_end_array (builder);
+  }
+  json_builder_end_object (builder);
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  generator = json_generator_new ();
+  json_generator_set_pretty (generator, TRUE);
+  json_generator_set_root (generator, root);
+  if (opt_output) {
+    ok = json_generator_to_file (generator, opt_output, &error);
+    if (!ok) {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+    }
+  } else {
+    char *json = json_generator_to_data (generator, NULL);
+    g_print ("%s\n", json);
+    g_free (json);
+  }
+
+  json_node_unref (root);
+  g_object_unref (generator);
+  g_object_unref (builder);
+  g_array_unref (sizes);
+  g_free (opt_sizes);
+  g_free (opt_output);
+  return ok ? 0 : 1;
+}
@@ -5,8 +5,8 @@ Summary:        Meme generator with text overlays
 License:        GPL-3.0-or-later
 URL:            https://github.com/vani-tty1/memerist
 Source0:        memerist-%{version}.tar.gz
-BuildRequires:  meson gcc pkgconfig(gtk4) pkgconfig(libadwaita-1) pkgconfig(cairo) desktop-file-utils
-Requires:       gtk4 libadwaita
+BuildRequires:  meson gcc pkgconfig(gtk4) pkgconfig(libadwaita-1) pkgconfig(cairo) pkgconfig(json-glib-1.0) desktop-file-utils
+Requires:       gtk4 libadwaita json-glib
 %description
 Create memes with custom text overlays using a native GNOME interface.
 
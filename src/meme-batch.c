@@ -0,0 +1,378 @@
+#include "meme-batch.h"
+#include "meme-renderer.h"
+#include "meme-export.h"
+#include <json-glib/json-glib.h>
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#endif
+
+typedef struct {
+  GMutex lock;
+  GHashTable *pixbufs;
+  GCancellable *cancellable;  /* fired by Ctrl+C */
+  guint done;
+  guint failed;
+  guint finished;
+} MemeBatchContext;
+
+typedef struct {
+  char *template_path;
+  char *output_path;
+  gboolean cinematic;
+  gboolean deep_fry;
+  guint32 seed;
+  MemeExportOptions options;
+  gboolean has_crop;
+  cairo_rectangle_int_t crop;  /* template pixels */
+  MemeLayerStack *layers;
+  GPtrArray *layer_sources;  /* parallel to layers, by position */
+} MemeBatchJob;
+
+static void meme_batch_job_free (gpointer data) {
+  MemeBatchJob *job = (MemeBatchJob *)data;
+  if (!job) return;
+  g_free (job->template_path);
+  g_free (job->output_path);
+  meme_layer_stack_free (job->layers);
+  g_ptr_array_unref (job->layer_sources);
+  g_free (job);
+}
+
+static char * resolve_path (const char *base_dir, const char *path) {
+  if (g_str_has_prefix (path, "resource://") || g_path_is_absolute (path)) return g_strdup (path);
+  return g_build_filename (base_dir, path, NULL);
+}
+
+static BlendMode parse_blend_mode (const char *name) {
+  if (g_strcmp0 (name, "multiply") == 0) return BLEND_MULTIPLY;
+  if (g_strcmp0 (name, "screen") == 0) return BLEND_SCREEN;
+  if (g_strcmp0 (name, "overlay") == 0) return BLEND_OVERLAY;
+  return BLEND_NORMAL;
+}
+
+static gboolean parse_layer (MemeBatchJob *job, JsonObject *obj, const char *base_dir, GError **error) {
+  const char *type = json_object_get_string_member_with_default (obj, "type", "text");
+  ImageLayer layer = { 0 };
+  char *source = NULL;
+
+  if (g_strcmp0 (type, "image") == 0) {
+    const char *path = json_object_get_string_member_with_default (obj, "path", NULL);
+    if (!path) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "image layer without \"path\"");
+      return FALSE;
+    }
+    layer.content.type = LAYER_TYPE_IMAGE;
+    source = resolve_path (base_dir, path);
+  } else {
+    layer.content.type = LAYER_TYPE_TEXT;
+    layer.content.text = g_ref_string_new (json_object_get_string_member_with_default (obj, "text", "Text"));
+    layer.content.font_size = json_object_get_double_member_with_default (obj, "font_size", 60.0);
+    layer.content.box_width = json_object_get_double_member_with_default (obj, "box_width", 0.0);
+    layer.content.box_height = json_object_get_double_member_with_default (obj, "box_height", 0.0);
+    layer.content.auto_fit = json_object_get_boolean_member_with_default (obj, "auto_fit", FALSE);
+  }
+
+  layer.geometry.x = json_object_get_double_member_with_default (obj, "x", 0.5);
+  layer.geometry.y = json_object_get_double_member_with_default (obj, "y", 0.5);
+  layer.geometry.scale = json_object_get_double_member_with_default (obj, "scale", 1.0);
+  layer.geometry.rotation = json_object_get_double_member_with_default (obj, "rotation", 0.0);
+  layer.content.opacity = json_object_get_double_member_with_default (obj, "opacity", 1.0);
+  layer.content.blend_mode = parse_blend_mode (json_object_get_string_member_with_default (obj, "blend", "normal"));
+  meme_layer_layout (&layer.geometry, &layer.content);
+
+  meme_layer_stack_insert (job->layers, -1, &layer);
+  g_ptr_array_add (job->layer_sources, source);
+  return TRUE;
+}
+
+/* @node as an array of exactly @length numbers, or NULL. */
+static JsonArray * json_array_of_numbers (JsonNode *node, guint length) {
+  JsonArray *array;
+  guint i;
+
+  if (!JSON_NODE_HOLDS_ARRAY (node)) return NULL;
+  array = json_node_get_array (node);
+  if (json_array_get_length (array) != length) return NULL;
+  for (i = 0; i < length; i++) {
+    JsonNode *element = json_array_get_element (array, i);
+    GType type = JSON_NODE_HOLDS_VALUE (element) ? json_node_get_value_type (element) : G_TYPE_INVALID;
+    if (type != G_TYPE_INT64 && type != G_TYPE_DOUBLE) return NULL;
+  }
+  return array;
+}
+
+static MemeBatchJob * parse_job (JsonNode *node, const char *base_dir, GError **error) {
+  MemeBatchJob *job;
+  JsonObject *obj;
+  const char *template_path, *output_path;
+
+  if (!JSON_NODE_HOLDS_OBJECT (node)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "job is not a JSON object");
+    return NULL;
+  }
+  obj = json_node_get_object (node);
+  template_path = json_object_get_string_member_with_default (obj, "template", NULL);
+  output_path = json_object_get_string_member_with_default (obj, "output", NULL);
+  if (!template_path || !output_path) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "job needs both \"template\" and \"output\"");
+    return NULL;
+  }
+
+  job = g_new0 (MemeBatchJob, 1);
+  job->template_path = resolve_path (base_dir, template_path);
+  job->output_path = resolve_path (base_dir, output_path);
+  job->cinematic = json_object_get_boolean_member_with_default (obj, "cinematic", FALSE);
+  job->deep_fry = json_object_get_boolean_member_with_default (obj, "deep_fry", FALSE);
+  job->seed = (guint32)json_object_get_int_member_with_default (obj, "seed", 0);
+  job->options.format = meme_export_format_from_path (job->output_path);
+  job->options.quality = (int)json_object_get_int_member_with_default (obj, "quality", MEME_EXPORT_DEFAULT_QUALITY);
+  job->options.max_bytes = (gsize)MAX (0, json_object_get_int_member_with_default (obj, "max_bytes", 0));
+  job->layers = meme_layer_stack_new ();
+  job->layer_sources = g_ptr_array_new_with_free_func (g_free);
+  if (json_object_has_member (obj, "crop")) {
+    JsonArray *crop = json_array_of_numbers (json_object_get_member (obj, "crop"), 4);
+    if (!crop) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "\"crop\" must be [x, y, width, height]");
+      meme_batch_job_free (job);
+      return NULL;
+    }
+    job->has_crop = TRUE;
+    job->crop.x = (int)json_array_get_double_element (crop, 0);
+    job->crop.y = (int)json_array_get_double_element (crop, 1);
+    job->crop.width = (int)json_array_get_double_element (crop, 2);
+    job->crop.height = (int)json_array_get_double_element (crop, 3);
+  }
+
+  if (json_object_has_member (obj, "layers")) {
+    JsonNode *layers_node = json_object_get_member (obj, "layers");
+    JsonArray *layers;
+    guint i, n;
+    if (!JSON_NODE_HOLDS_ARRAY (layers_node)) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "\"layers\" must be an array");
+      meme_batch_job_free (job);
+      return NULL;
+    }
+    layers = json_node_get_array (layers_node);
+    n = json_array_get_length (layers);
+    for (i = 0; i < n; i++) {
+      JsonNode *layer_node = json_array_get_element (layers, i);
+      if (!JSON_NODE_HOLDS_OBJECT (layer_node)) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "layer %u is not a JSON object", i);
+        meme_batch_job_free (job);
+        return NULL;
+      }
+      if (!parse_layer (job, json_node_get_object (layer_node), base_dir, error)) {
+        meme_batch_job_free (job);
+        return NULL;
+      }
+    }
+  }
+  return job;
+}
+
+static gboolean load_ndjson (GPtrArray *jobs, const char *path, const char *base_dir, GError **error) {
+  char *contents = NULL;
+  char **lines;
+  JsonParser *parser;
+  gboolean ok = TRUE;
+  int i;
+
+  if (!g_file_get_contents (path, &contents, NULL, error)) return FALSE;
+  lines = g_strsplit (contents, "\n", -1);
+  parser = json_parser_new ();
+
+  for (i = 0; ok && lines[i] != NULL; i++) {
+    char *line = g_strstrip (lines[i]);
+    MemeBatchJob *job;
+    if (*line == '\0') continue;
+    ok = json_parser_load_from_data (parser, line, -1, error);
+    if (ok) {
+      job = parse_job (json_parser_get_root (parser), base_dir, error);
+      if (job) g_ptr_array_add (jobs, job);
+      else ok = FALSE;
+    }
+    if (!ok) g_prefix_error (error, "line %d: ", i + 1);
+  }
+
+  g_object_unref (parser);
+  g_strfreev (lines);
+  g_free (contents);
+  return ok;
+}
+
+static gboolean load_json (GPtrArray *jobs, const char *path, const char *base_dir, GError **error) {
+  JsonParser *parser = json_parser_new ();
+  JsonNode *root;
+  gboolean ok = json_parser_load_from_file (parser, path, error);
+
+  if (ok) {
+    root = json_parser_get_root (parser);
+    if (root && JSON_NODE_HOLDS_ARRAY (root)) {
+      JsonArray *array = json_node_get_array (root);
+      guint i, n = json_array_get_length (array);
+      for (i = 0; ok && i < n; i++) {
+        MemeBatchJob *job = parse_job (json_array_get_element (array, i), base_dir, error);
+        if (job) g_ptr_array_add (jobs, job);
+        else { g_prefix_error (error, "job %u: ", i); ok = FALSE; }
+      }
+    } else if (root) {
+      MemeBatchJob *job = parse_job (root, base_dir, error);
+      if (job) g_ptr_array_add (jobs, job);
+      else ok = FALSE;
+    }
+  }
+
+  g_object_unref (parser);
+  return ok;
+}
+
+static GPtrArray * meme_batch_load_jobs (const char *path, gboolean ndjson, GError **error) {
+  GPtrArray *jobs = g_ptr_array_new_with_free_func (meme_batch_job_free);
+  char *base_dir = g_path_get_dirname (path);
+  gboolean ok = ndjson ? load_ndjson (jobs, path, base_dir, error) : load_json (jobs, path, base_dir, error);
+
+  g_free (base_dir);
+  if (!ok) { g_ptr_array_unref (jobs); return NULL; }
+  return jobs;
+}
+
+/* Templates and stickers are usually shared by many jobs of a batch, so each
+ * file is decoded once and the (read-only) pixbuf is shared between workers. */
+static GdkPixbuf * batch_context_get_pixbuf (MemeBatchContext *ctx, const char *path, GError **error) {
+  GdkPixbuf *pixbuf;
+
+  g_mutex_lock (&ctx->lock);
+  pixbuf = g_hash_table_lookup (ctx->pixbufs, path);
+  if (pixbuf) g_object_ref (pixbuf);
+  g_mutex_unlock (&ctx->lock);
+  if (pixbuf) return pixbuf;
+
+  if (g_str_has_prefix (path, "resource://")) pixbuf = gdk_pixbuf_new_from_resource (path + 11, error);
+  else pixbuf = gdk_pixbuf_new_from_file (path, error);
+  if (!pixbuf) return NULL;
+
+  g_mutex_lock (&ctx->lock);
+  if (!g_hash_table_contains (ctx->pixbufs, path))
+    g_hash_table_insert (ctx->pixbufs, g_strdup (path), g_object_ref (pixbuf));
+  g_mutex_unlock (&ctx->lock);
+  return pixbuf;
+}
+
+static void render_job (gpointer data, gpointer user_data) {
+  MemeBatchJob *job = (MemeBatchJob *)data;
+  MemeBatchContext *ctx = (MemeBatchContext *)user_data;
+  GdkPixbuf *bg, *result = NULL;
+  GError *error = NULL;
+  guint i, n = meme_layer_stack_get_n_layers (job->layers);
+
+  /* Jobs still queued after an interrupt are dropped without a word. */
+  bg = g_cancellable_set_error_if_cancelled (ctx->cancellable, &error) ? NULL
+       : batch_context_get_pixbuf (ctx, job->template_path, &error);
+
+  for (i = 0; bg && i < n; i++) {
+    LayerGeometry *layer = meme_layer_stack_get_geometry (job->layers, i);
+    LayerContent *content = meme_layer_stack_get_content (job->layers, i);
+    const char *source = g_ptr_array_index (job->layer_sources, i);
+    if (!source || content->pixbuf) continue;
+    content->pixbuf = batch_context_get_pixbuf (ctx, source, &error);
+    if (!content->pixbuf) { g_clear_object (&bg); break; }
+    layer->width = gdk_pixbuf_get_width (content->pixbuf);
+    layer->height = gdk_pixbuf_get_height (content->pixbuf);
+  }
+
+  if (bg) {
+    cairo_surface_t *surf = meme_render_composite (bg, NULL, job->layers, job->has_crop ? &job->crop : NULL,
+                                                   job->cinematic, job->deep_fry, job->seed, ctx->cancellable);
+    GBytes *bytes;
+    if (surf) {
+      /* The only unpremultiply of the whole job. */
+      result = gdk_pixbuf_get_from_surface (surf, 0, 0, cairo_image_surface_get_width (surf), cairo_image_surface_get_height (surf));
+      cairo_surface_destroy (surf);
+      if (!result) g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "the crop is outside the template");
+    } else if (!g_cancellable_set_error_if_cancelled (ctx->cancellable, &error)) {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "not enough memory to render the image");
+    }
+    bytes = result ? meme_export_encode (result, &job->options, ctx->cancellable, &error) : NULL;
+    if (!bytes || !g_file_set_contents (job->output_path, g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes), &error))
+      g_clear_object (&result);
+    g_clear_pointer (&bytes, g_bytes_unref);
+    g_object_unref (bg);
+  }
+
+  if (result) {
+    g_atomic_int_inc (&ctx->done);
+    g_object_unref (result);
+  } else {
+    g_atomic_int_inc (&ctx->failed);
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_printerr ("%s: %s\n", job->output_path, error ? error->message : "render failed");
+  }
+  g_clear_error (&error);
+  g_atomic_int_inc (&ctx->finished);
+  g_main_context_wakeup (NULL);
+}
+
+#ifdef G_OS_UNIX
+/* Running jobs stop at their next band of pixels, queued ones never start. */
+static gboolean on_batch_interrupt (gpointer user_data) {
+  MemeBatchContext *ctx = (MemeBatchContext *)user_data;
+  g_printerr ("Interrupted, cancelling the remaining jobs\n");
+  g_cancellable_cancel (ctx->cancellable);
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+int meme_batch_run (const char *path, gboolean ndjson, int n_workers) {
+  MemeBatchContext ctx = { 0 };
+  GThreadPool *pool;
+  GPtrArray *jobs;
+  GError *error = NULL;
+  gint64 start, elapsed;
+  double seconds;
+  guint i, interrupt_id = 0;
+
+  jobs = meme_batch_load_jobs (path, ndjson, &error);
+  if (!jobs) {
+    g_printerr ("%s: %s\n", path, error->message);
+    g_error_free (error);
+    return 1;
+  }
+
+  if (n_workers <= 0) n_workers = (int)g_get_num_processors ();
+  g_mutex_init (&ctx.lock);
+  ctx.pixbufs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  ctx.cancellable = g_cancellable_new ();
+
+  start = g_get_monotonic_time ();
+  pool = g_thread_pool_new (render_job, &ctx, n_workers, TRUE, &error);
+  if (!pool) {
+    g_printerr ("Could not start worker threads: %s\n", error->message);
+    g_error_free (error);
+    g_hash_table_unref (ctx.pixbufs);
+    g_object_unref (ctx.cancellable);
+    g_mutex_clear (&ctx.lock);
+    g_ptr_array_unref (jobs);
+    return 1;
+  }
+#ifdef G_OS_UNIX
+  interrupt_id = g_unix_signal_add (SIGINT, on_batch_interrupt, &ctx);
+#endif
+  for (i = 0; i < jobs->len; i++) g_thread_pool_push (pool, g_ptr_array_index (jobs, i), NULL);
+  /* Wait on the main context rather than in the pool, so the interrupt
+   * handler gets to run; each finished job wakes it up. */
+  while (g_atomic_int_get (&ctx.finished) < jobs->len) g_main_context_iteration (NULL, TRUE);
+  if (interrupt_id) g_source_remove (interrupt_id);
+  g_thread_pool_free (pool, FALSE, TRUE);
+  elapsed = g_get_monotonic_time () - start;
+
+  seconds = MAX (elapsed, 1) / (double)G_USEC_PER_SEC;
+  g_print ("Rendered %u of %u memes in %.2f s with %d workers (%.1f memes/s)\n",
+           ctx.done, jobs->len, seconds, n_workers, ctx.done / seconds);
+
+  g_hash_table_unref (ctx.pixbufs);
+  g_object_unref (ctx.cancellable);
+  g_mutex_clear (&ctx.lock);
+  g_ptr_array_unref (jobs);
+  return ctx.failed > 0 ? 1 : 0;
+}
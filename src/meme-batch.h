@@ -0,0 +1,8 @@
+#pragma once
+#include "meme-core.h"
+
+/* Headless rendering: reads jobs from a JSON file (a single job object or an
+ * array of jobs) or from an NDJSON file (one job per line) and renders them
+ * on a pool of worker threads without creating any window.
+ * Returns the process exit status. */
+int meme_batch_run (const char *path, gboolean ndjson, int n_workers);
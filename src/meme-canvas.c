@@ -0,0 +1,134 @@
+#include "meme-canvas.h"
+#include "meme-renderer.h"
+
+struct _MemeCanvas {
+  GtkWidget parent_instance;
+
+  GdkTexture *texture;
+  int doc_width;
+  int doc_height;
+  int last_width;
+  int last_height;
+
+  gboolean has_selection;
+  LayerGeometry selection;
+
+  gboolean crop_active;
+  double crop_x;
+  double crop_y;
+  double crop_w;
+  double crop_h;
+};
+
+G_DEFINE_FINAL_TYPE (MemeCanvas, meme_canvas, GTK_TYPE_WIDGET)
+
+enum {
+  VIEWPORT_CHANGED,
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+static void meme_canvas_snapshot (GtkWidget *widget, GtkSnapshot *snapshot) {
+  MemeCanvas *self = MEME_CANVAS (widget);
+  double ww, wh, iw, ih, scale, draw_w, draw_h, off_x, off_y;
+  graphene_rect_t bounds;
+  cairo_t *cr;
+
+  if (!self->texture) return;
+
+  ww = gtk_widget_get_width (widget);
+  wh = gtk_widget_get_height (widget);
+  iw = self->doc_width > 0 ? self->doc_width : gdk_texture_get_width (self->texture);
+  ih = self->doc_height > 0 ? self->doc_height : gdk_texture_get_height (self->texture);
+  if (ww <= 0 || wh <= 0 || iw <= 0 || ih <= 0) return;
+
+  /* Same fit as meme_get_image_coordinates (). */
+  scale = MIN (ww / iw, wh / ih);
+  draw_w = iw * scale;
+  draw_h = ih * scale;
+  off_x = (ww - draw_w) / 2.0;
+  off_y = (wh - draw_h) / 2.0;
+
+  bounds = GRAPHENE_RECT_INIT (off_x, off_y, draw_w, draw_h);
+  gtk_snapshot_append_scaled_texture (snapshot, self->texture, GSK_SCALING_FILTER_TRILINEAR, &bounds);
+
+  if (!self->crop_active && !self->has_selection) return;
+
+  cr = gtk_snapshot_append_cairo (snapshot, &bounds);
+  cairo_translate (cr, off_x, off_y);
+  cairo_scale (cr, scale, scale);
+  meme_render_editor_overlay (cr, iw, ih,
+                              self->has_selection ? &self->selection : NULL,
+                              self->crop_active,
+                              self->crop_x, self->crop_y, self->crop_w, self->crop_h,
+                              1.0 / scale);
+  cairo_destroy (cr);
+}
+
+static void meme_canvas_size_allocate (GtkWidget *widget, int width, int height, int baseline) {
+  MemeCanvas *self = MEME_CANVAS (widget);
+  if (width == self->last_width && height == self->last_height) return;
+  self->last_width = width;
+  self->last_height = height;
+  g_signal_emit (self, signals[VIEWPORT_CHANGED], 0);
+}
+
+static void meme_canvas_dispose (GObject *object) {
+  MemeCanvas *self = MEME_CANVAS (object);
+  g_clear_object (&self->texture);
+  G_OBJECT_CLASS (meme_canvas_parent_class)->dispose (object);
+}
+
+static void meme_canvas_class_init (MemeCanvasClass *klass) {
+  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = meme_canvas_dispose;
+  widget_class->snapshot = meme_canvas_snapshot;
+  widget_class->size_allocate = meme_canvas_size_allocate;
+
+  signals[VIEWPORT_CHANGED] = g_signal_new ("viewport-changed",
+                                            G_TYPE_FROM_CLASS (klass),
+                                            G_SIGNAL_RUN_LAST,
+                                            0, NULL, NULL, NULL,
+                                            G_TYPE_NONE, 0);
+}
+
+static void meme_canvas_init (MemeCanvas *self) {
+}
+
+GtkWidget * meme_canvas_new (void) {
+  return g_object_new (MEME_TYPE_CANVAS, NULL);
+}
+
+void meme_canvas_set_texture (MemeCanvas *self, GdkTexture *texture) {
+  g_return_if_fail (MEME_IS_CANVAS (self));
+  if (texture) g_object_ref (texture);
+  g_clear_object (&self->texture);
+  self->texture = texture;
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+void meme_canvas_set_document_size (MemeCanvas *self, int width, int height) {
+  g_return_if_fail (MEME_IS_CANVAS (self));
+  self->doc_width = width;
+  self->doc_height = height;
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+void meme_canvas_set_selection (MemeCanvas *self, const LayerGeometry *layer) {
+  g_return_if_fail (MEME_IS_CANVAS (self));
+  self->has_selection = (layer != NULL);
+  /* A copy; don't keep pointers into the stack. */
+  if (layer) self->selection = *layer;
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+void meme_canvas_set_crop (MemeCanvas *self, gboolean active, double x, double y, double w, double h) {
+  g_return_if_fail (MEME_IS_CANVAS (self));
+  self->crop_active = active;
+  self->crop_x = x; self->crop_y = y;
+  self->crop_w = w; self->crop_h = h;
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
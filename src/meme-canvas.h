@@ -0,0 +1,24 @@
+#pragma once
+#include "meme-core.h"
+
+G_BEGIN_DECLS
+
+/* Editor canvas: shows the composite texture scaled to fit and draws the
+ * selection box and crop chrome on top of it at snapshot time, so overlay
+ * changes never touch the composite pixels.
+ *
+ * The texture may be smaller than the document (preview resolution); the
+ * document size set here is what layout and chrome are computed against.
+ * "viewport-changed" is emitted when the allocation changes size. */
+
+#define MEME_TYPE_CANVAS (meme_canvas_get_type())
+
+G_DECLARE_FINAL_TYPE (MemeCanvas, meme_canvas, MEME, CANVAS, GtkWidget)
+
+GtkWidget *meme_canvas_new (void);
+void meme_canvas_set_texture (MemeCanvas *self, GdkTexture *texture);
+void meme_canvas_set_document_size (MemeCanvas *self, int width, int height);
+void meme_canvas_set_selection (MemeCanvas *self, const LayerGeometry *layer);
+void meme_canvas_set_crop (MemeCanvas *self, gboolean active, double x, double y, double w, double h);
+
+G_END_DECLS
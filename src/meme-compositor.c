@@ -0,0 +1,331 @@
+#include "meme-compositor.h"
+#include "meme-renderer.h"
+#include "meme-geometry.h"
+#include <cairo.h>
+#include <math.h>
+#include <string.h>
+
+typedef struct {
+  ImageLayer state;
+  cairo_rectangle_int_t bounds;
+} LayerRecord;
+
+/* A filtered copy of the composite that GTK displays through a
+ * GdkMemoryTexture. Textures must never change under GTK, so a buffer is
+ * only rewritten once no texture references it any more; @stale collects
+ * the damage of every frame since the buffer was last brought up to date. */
+typedef struct {
+  cairo_surface_t *surface;
+  cairo_region_t *stale;
+  gboolean cinematic;
+  gboolean deep_fry;
+  guint32 seed;
+} FrameBuffer;
+
+struct _MemeCompositor {
+  GdkPixbuf *bg;
+  MemeGeometry geometry;
+  int doc_width;
+  int doc_height;
+  int width;
+  int height;
+  cairo_surface_t *bg_surface;
+  cairo_surface_t *base;
+  cairo_surface_t *composite;
+  int base_count;
+  GArray *records;
+  FrameBuffer frames[2];
+  int last_frame;
+};
+
+static void record_clear (gpointer data) {
+  LayerRecord *rec = (LayerRecord *)data;
+  meme_layer_clear (&rec->state);
+  rec->state.geometry.id = 0;
+}
+
+/* The record holds refs on the text and the pixbuf, so comparing against it
+ * stays valid whatever happens to the layer itself. */
+static void record_set (LayerRecord *rec, const LayerGeometry *geometry, const LayerContent *content,
+                        const cairo_rectangle_int_t *bounds) {
+  record_clear (rec);
+  rec->state.geometry = *geometry;
+  meme_layer_content_init_copy (&rec->state.content, content);
+  rec->bounds = *bounds;
+}
+
+static gboolean record_differs (const LayerRecord *rec, const LayerGeometry *g, const LayerContent *c) {
+  const LayerGeometry *sg = &rec->state.geometry;
+  const LayerContent *sc = &rec->state.content;
+  return sg->x != g->x || sg->y != g->y || sg->width != g->width || sg->height != g->height ||
+         sg->scale != g->scale || sg->rotation != g->rotation || sg->outline != g->outline ||
+         sc->type != c->type || sc->pixbuf != c->pixbuf ||
+         (sc->text != c->text && g_strcmp0 (sc->text, c->text) != 0) || sc->font_size != c->font_size ||
+         sc->box_width != c->box_width || sc->box_height != c->box_height ||
+         sc->opacity != c->opacity || sc->blend_mode != c->blend_mode;
+}
+
+MemeCompositor * meme_compositor_new (void) {
+  MemeCompositor *comp = g_new0 (MemeCompositor, 1);
+  comp->records = g_array_new (FALSE, TRUE, sizeof (LayerRecord));
+  g_array_set_clear_func (comp->records, record_clear);
+  comp->base_count = -1;
+  return comp;
+}
+
+void meme_compositor_invalidate (MemeCompositor *comp) {
+  guint i;
+
+  g_clear_object (&comp->bg);
+  g_clear_pointer (&comp->bg_surface, cairo_surface_destroy);
+  g_clear_pointer (&comp->base, cairo_surface_destroy);
+  g_clear_pointer (&comp->composite, cairo_surface_destroy);
+  g_array_set_size (comp->records, 0);
+  comp->base_count = -1;
+  for (i = 0; i < G_N_ELEMENTS (comp->frames); i++) {
+    g_clear_pointer (&comp->frames[i].surface, cairo_surface_destroy);
+    g_clear_pointer (&comp->frames[i].stale, cairo_region_destroy);
+  }
+}
+
+void meme_compositor_free (MemeCompositor *comp) {
+  if (!comp) return;
+  meme_compositor_invalidate (comp);
+  g_array_unref (comp->records);
+  g_free (comp);
+}
+
+/* Layers are laid out in document pixels; the surfaces may be smaller. */
+static void compositor_apply_scale (MemeCompositor *comp, cairo_t *cr) {
+  cairo_scale (cr, (double)comp->width / comp->doc_width, (double)comp->height / comp->doc_height);
+}
+
+static void to_surface_rect (MemeCompositor *comp, cairo_rectangle_int_t *r) {
+  double sx = (double)comp->width / comp->doc_width, sy = (double)comp->height / comp->doc_height;
+  int x0 = (int)floor (r->x * sx), y0 = (int)floor (r->y * sy);
+  int x1 = (int)ceil ((r->x + r->width) * sx), y1 = (int)ceil ((r->y + r->height) * sy);
+  r->x = x0; r->y = y0;
+  r->width = x1 - x0; r->height = y1 - y0;
+}
+
+static void compositor_reset (MemeCompositor *comp, GdkPixbuf *bg, const MemeGeometry *geometry, int width, int height) {
+  cairo_t *cr;
+
+  meme_compositor_invalidate (comp);
+  comp->bg = g_object_ref (bg);
+  comp->geometry = *geometry;
+  comp->doc_width = meme_geometry_get_width (geometry);
+  comp->doc_height = meme_geometry_get_height (geometry);
+  comp->width = width;
+  comp->height = height;
+  comp->bg_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, comp->width, comp->height);
+  comp->base = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, comp->width, comp->height);
+  comp->composite = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, comp->width, comp->height);
+
+  /* Convert, orient and downscale the template once instead of on every
+   * frame; a rotation or crop only costs this one repaint. */
+  cr = cairo_create (comp->bg_surface);
+  compositor_apply_scale (comp, cr);
+  meme_geometry_set_source (cr, geometry, bg);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+}
+
+static void rebuild_base (MemeCompositor *comp, MemeLayerStack *layers, int count) {
+  cairo_t *cr = cairo_create (comp->base);
+  int i;
+
+  cairo_set_source_surface (cr, comp->bg_surface, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+  compositor_apply_scale (comp, cr);
+  for (i = 0; i < count; i++)
+    meme_render_layer (cr, meme_layer_stack_get_geometry (layers, i), meme_layer_stack_get_content (layers, i),
+                       comp->doc_width, comp->doc_height);
+  cairo_destroy (cr);
+  comp->base_count = count;
+}
+
+/* Repaints base and every layer from the edited one upwards, clipped to
+ * @region (NULL repaints the whole frame). */
+static void recomposite (MemeCompositor *comp, MemeLayerStack *layers, int n, int first, cairo_region_t *region) {
+  cairo_t *cr = cairo_create (comp->composite);
+  int i;
+
+  if (region) {
+    for (i = 0; i < cairo_region_num_rectangles (region); i++) {
+      cairo_rectangle_int_t r;
+      cairo_region_get_rectangle (region, i, &r);
+      cairo_rectangle (cr, r.x, r.y, r.width, r.height);
+    }
+    cairo_clip (cr);
+  }
+
+  cairo_set_source_surface (cr, comp->base, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+  compositor_apply_scale (comp, cr);
+  for (i = first; i < n; i++)
+    meme_render_layer (cr, meme_layer_stack_get_geometry (layers, i), meme_layer_stack_get_content (layers, i),
+                       comp->doc_width, comp->doc_height);
+  cairo_destroy (cr);
+}
+
+/* Picks a frame buffer GTK is done with, preferring the one from the last
+ * frame since it has the least to catch up on; allocates if both are busy. */
+static FrameBuffer * compositor_acquire_frame (MemeCompositor *comp, gboolean cinematic, gboolean deep_fry, guint32 seed) {
+  cairo_rectangle_int_t frame = { 0, 0, comp->width, comp->height };
+  int order[2] = { comp->last_frame, 1 - comp->last_frame };
+  FrameBuffer *fb = NULL;
+  int i;
+
+  for (i = 0; i < 2 && !fb; i++) {
+    FrameBuffer *f = &comp->frames[order[i]];
+    if (f->surface && cairo_surface_get_reference_count (f->surface) == 1) { fb = f; comp->last_frame = order[i]; }
+  }
+  if (!fb) {
+    comp->last_frame = order[1];
+    fb = &comp->frames[comp->last_frame];
+    g_clear_pointer (&fb->surface, cairo_surface_destroy);
+    g_clear_pointer (&fb->stale, cairo_region_destroy);
+    fb->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, comp->width, comp->height);
+    fb->stale = cairo_region_create_rectangle (&frame);
+  }
+
+  if (fb->cinematic != cinematic || fb->deep_fry != deep_fry || fb->seed != seed) {
+    cairo_region_union_rectangle (fb->stale, &frame);
+    fb->cinematic = cinematic; fb->deep_fry = deep_fry; fb->seed = seed;
+  }
+  return fb;
+}
+
+/* Copies the stale parts of the composite into @fb and filters just those.
+ * Deep fry works on whole pixelation cells, laid out in document pixels so
+ * the preview matches the export, so its areas are widened to the cell
+ * grid at the preview's scale first. */
+static void compositor_update_frame (MemeCompositor *comp, FrameBuffer *fb) {
+  cairo_rectangle_int_t frame = { 0, 0, comp->width, comp->height };
+  unsigned char *src = cairo_image_surface_get_data (comp->composite);
+  unsigned char *dst;
+  int stride = cairo_image_surface_get_stride (comp->composite);
+  double sx = (double)comp->width / comp->doc_width, sy = (double)comp->height / comp->doc_height;
+  int i, y;
+
+  if (fb->deep_fry) {
+    cairo_region_t *cells = cairo_region_create ();
+    for (i = 0; i < cairo_region_num_rectangles (fb->stale); i++) {
+      cairo_rectangle_int_t r;
+      cairo_region_get_rectangle (fb->stale, i, &r);
+      meme_render_align_to_fry_cells (&r, sx, sy);
+      cairo_region_union_rectangle (cells, &r);
+    }
+    cairo_region_destroy (fb->stale);
+    fb->stale = cells;
+  }
+  cairo_region_intersect_rectangle (fb->stale, &frame);
+
+  cairo_surface_flush (fb->surface);
+  dst = cairo_image_surface_get_data (fb->surface);
+  for (i = 0; i < cairo_region_num_rectangles (fb->stale); i++) {
+    cairo_rectangle_int_t r;
+    cairo_region_get_rectangle (fb->stale, i, &r);
+    for (y = r.y; y < r.y + r.height; y++)
+      memcpy (dst + (gsize)y * stride + r.x * 4, src + (gsize)y * stride + r.x * 4, (gsize)r.width * 4);
+    meme_render_post_process (fb->surface, &r, sx, sy, fb->cinematic, fb->deep_fry, fb->seed);
+  }
+  cairo_surface_mark_dirty (fb->surface);
+
+  cairo_region_destroy (fb->stale);
+  fb->stale = cairo_region_create ();
+}
+
+/* GDK_MEMORY_DEFAULT is cairo's ARGB32, so GTK takes the pixels as they are.
+ * The GBytes keeps the surface alive for as long as the texture exists. */
+static GdkTexture * frame_texture (cairo_surface_t *surface) {
+  int stride = cairo_image_surface_get_stride (surface);
+  int height = cairo_image_surface_get_height (surface);
+  GBytes *bytes = g_bytes_new_with_free_func (cairo_image_surface_get_data (surface), (gsize)stride * height,
+                                              (GDestroyNotify)cairo_surface_destroy, cairo_surface_reference (surface));
+  GdkTexture *texture = gdk_memory_texture_new (cairo_image_surface_get_width (surface), height,
+                                                GDK_MEMORY_DEFAULT, bytes, stride);
+  g_bytes_unref (bytes);
+  return texture;
+}
+
+GdkTexture * meme_compositor_render (MemeCompositor *comp, GdkPixbuf *bg, const MemeGeometry *geometry, MemeLayerStack *layers, MemeLayerId active, double scale, gboolean cinematic, gboolean deep_fry, guint32 seed) {
+  LayerGeometry *layer;
+  cairo_rectangle_int_t bounds;
+  cairo_rectangle_int_t frame;
+  cairo_region_t *damage;
+  FrameBuffer *fb;
+  gboolean full;
+  int n, i, k = 0, width, height;
+
+  if (!bg) return NULL;
+  scale = CLAMP (scale, 0.0, 1.0);
+  width = MAX (1, (int)round (meme_geometry_get_width (geometry) * scale));
+  height = MAX (1, (int)round (meme_geometry_get_height (geometry) * scale));
+  full = (bg != comp->bg || !comp->composite || !meme_geometry_equal (geometry, &comp->geometry) ||
+          width != comp->width || height != comp->height);
+  if (full) compositor_reset (comp, bg, geometry, width, height);
+  frame = (cairo_rectangle_int_t){ 0, 0, comp->width, comp->height };
+
+  n = (int)meme_layer_stack_get_n_layers (layers);
+  k = MAX (0, meme_layer_stack_find (layers, active));
+  /* Adding, removing or reordering layers repaints everything. */
+  if (!full && (int)comp->records->len != n) full = TRUE;
+  for (i = 0; !full && i < n; i++) {
+    if (g_array_index (comp->records, LayerRecord, i).state.geometry.id != meme_layer_stack_get_geometry (layers, i)->id)
+      full = TRUE;
+  }
+
+  if (full) {
+    rebuild_base (comp, layers, k);
+    recomposite (comp, layers, n, k, NULL);
+    g_array_set_size (comp->records, n);
+    for (i = 0; i < n; i++) {
+      layer = meme_layer_stack_get_geometry (layers, i);
+      meme_layer_get_bounds (layer, comp->doc_width, comp->doc_height, &bounds);
+      to_surface_rect (comp, &bounds);
+      record_set (&g_array_index (comp->records, LayerRecord, i), layer, meme_layer_stack_get_content (layers, i), &bounds);
+    }
+    damage = cairo_region_create_rectangle (&frame);
+  } else {
+    int first_dirty = n;
+
+    damage = cairo_region_create ();
+    for (i = 0; i < n; i++) {
+      LayerRecord *rec = &g_array_index (comp->records, LayerRecord, i);
+      LayerContent *content = meme_layer_stack_get_content (layers, i);
+      layer = meme_layer_stack_get_geometry (layers, i);
+      if (!record_differs (rec, layer, content)) continue;
+      meme_layer_get_bounds (layer, comp->doc_width, comp->doc_height, &bounds);
+      to_surface_rect (comp, &bounds);
+      cairo_region_union_rectangle (damage, &rec->bounds);
+      cairo_region_union_rectangle (damage, &bounds);
+      record_set (rec, layer, content, &bounds);
+      if (first_dirty == n) first_dirty = i;
+    }
+    cairo_region_intersect_rectangle (damage, &frame);
+
+    if (!cairo_region_is_empty (damage)) {
+      /* The base is rebuilt once when the edited layer changes (or a layer
+       * baked into it was modified); later frames only pay for the damage. */
+      if (comp->base_count != k || first_dirty < k) rebuild_base (comp, layers, k);
+      recomposite (comp, layers, n, k, damage);
+    }
+  }
+  cairo_surface_flush (comp->composite);
+
+  for (i = 0; i < (int)G_N_ELEMENTS (comp->frames); i++) {
+    if (comp->frames[i].stale) cairo_region_union (comp->frames[i].stale, damage);
+  }
+  cairo_region_destroy (damage);
+
+  fb = compositor_acquire_frame (comp, cinematic, deep_fry, seed);
+  compositor_update_frame (comp, fb);
+  return frame_texture (fb->surface);
+}
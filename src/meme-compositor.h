@@ -0,0 +1,37 @@
+#pragma once
+#include "meme-layers.h"
+#include "meme-geometry.h"
+
+/* Retained compositor for interactive editing.
+ *
+ * Keeps the last composite plus a cached "base" (template and every layer
+ * below the one being edited). Layer changes are detected by diffing against
+ * the state used for the previous frame, and only the bounding region of the
+ * dirty layers is recomposited: base, then the edited layer and the layers
+ * above it, clipped to that region.
+ *
+ * The document is @bg seen through @geometry. @scale (at most 1.0) sets the
+ * output size relative to the document, so the editor can composite at
+ * viewport resolution; layer coordinates stay in document pixels. A new
+ * geometry repaints everything once, from @bg's own pixels. Full-resolution
+ * output is meme_render_composite ()'s job.
+ *
+ * The result is a GdkMemoryTexture over a premultiplied ARGB32 buffer the
+ * compositor owns (double-buffered, so only the damage is copied and
+ * filtered each frame); nothing is converted on the way to GTK. */
+
+typedef struct _MemeCompositor MemeCompositor;
+
+MemeCompositor *meme_compositor_new (void);
+void meme_compositor_free (MemeCompositor *comp);
+void meme_compositor_invalidate (MemeCompositor *comp);
+
+GdkTexture *meme_compositor_render (MemeCompositor *comp,
+                                    GdkPixbuf *bg,
+                                    const MemeGeometry *geometry,
+                                    MemeLayerStack *layers,
+                                    MemeLayerId active,
+                                    double scale,
+                                    gboolean cinematic,
+                                    gboolean deep_fry,
+                                    guint32 seed);
@@ -1,31 +1,19 @@
 #include "meme-core.h"
 
-ImageLayer * meme_layer_copy (const ImageLayer *src) {
-  ImageLayer *dst = g_new0 (ImageLayer, 1);
+void meme_layer_content_init_copy (LayerContent *dst, const LayerContent *src) {
   *dst = *src;
   if (src->pixbuf) g_object_ref (src->pixbuf);
-  if (src->text) dst->text = g_strdup (src->text);
-  return dst;
+  if (src->text) g_ref_string_acquire (src->text);
 }
 
-void meme_layer_free (gpointer data) {
-  ImageLayer *layer = (ImageLayer *)data;
-  if (layer) {
-    if (layer->pixbuf) g_object_unref (layer->pixbuf);
-    if (layer->text) g_free (layer->text);
-    g_free (layer);
-  }
+void meme_layer_content_clear (LayerContent *content) {
+  if (!content) return;
+  g_clear_object (&content->pixbuf);
+  if (content->text) g_ref_string_release (content->text);
+  content->text = NULL;
 }
 
-GList * meme_layer_list_copy (GList *src) {
-  GList *dst = NULL;
-  GList *l;
-  for (l = src; l != NULL; l = l->next) {
-    dst = g_list_append (dst, meme_layer_copy ((ImageLayer *)l->data));
-  }
-  return dst;
+void meme_layer_clear (ImageLayer *layer) {
+  if (!layer) return;
+  meme_layer_content_clear (&layer->content);
 }
-
-void meme_layer_list_free (GList *list) {
-    g_list_free_full (list, (GDestroyNotify)meme_layer_free);
-}
\ No newline at end of file
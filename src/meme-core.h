@@ -37,23 +37,44 @@ typedef enum {
   LAYER_TYPE_TEXT
 } LayerType;
 
+/* Stable layer handle; 0 means "no layer". */
+typedef guint MemeLayerId;
+
+/* Where a layer sits: all that hit-testing, bounds and reordering read, so
+ * the stack keeps these packed apart from the content. */
 typedef struct {
-  LayerType type;
-  GdkPixbuf *pixbuf;
-  char *text;
-  double font_size;
-  double x;
+  MemeLayerId id;
+  double x;           /* centre, as fractions of the image */
   double y;
-  double width;
+  double width;       /* unscaled, in template pixels */
   double height;
   double scale;
   double rotation;
+  double outline;     /* painted past the box (half a text stroke), unscaled */
+} LayerGeometry;
+
+/* What a layer shows; only layout and painting read it. */
+typedef struct {
+  LayerType type;
   double opacity;
   BlendMode blend_mode;
+  double font_size;
+  double box_width;   /* text box in template pixels; 0 = no wrapping */
+  double box_height;
+  gboolean auto_fit;  /* pick font_size so the text fills the box */
+  char *text;         /* GRefString, shared between copies */
+  GdkPixbuf *pixbuf;
+} LayerContent;
+
+/* A whole layer by value, as it goes into and out of the stack and the
+ * undo history. */
+typedef struct {
+  LayerGeometry geometry;
+  LayerContent content;
 } ImageLayer;
 
 
-ImageLayer *meme_layer_copy (const ImageLayer *src);
-void meme_layer_free (gpointer data);
-GList *meme_layer_list_copy (GList *src);
-void meme_layer_list_free (GList *list);
\ No newline at end of file
+/* Layers are plain values; these manage the text and pixbuf references. */
+void meme_layer_content_init_copy (LayerContent *dst, const LayerContent *src);
+void meme_layer_content_clear (LayerContent *content);
+void meme_layer_clear (ImageLayer *layer);
@@ -0,0 +1,255 @@
+#include "meme-export.h"
+#include "meme-renderer.h"
+#include "meme-loader.h"
+
+typedef struct {
+  GdkPixbuf *bg;
+  MemeGeometry geometry;
+  char *source_path;
+  MemeLayerStack *layers;
+  gboolean cinematic;
+  gboolean deep_fry;
+  guint32 seed;
+  gboolean has_crop;
+  cairo_rectangle_t crop;
+  GFile *file;
+  MemeExportOptions options;
+} ExportData;
+
+static void export_data_free (gpointer data) {
+  ExportData *export = (ExportData *)data;
+  g_object_unref (export->bg);
+  g_free (export->source_path);
+  meme_layer_stack_free (export->layers);
+  g_object_unref (export->file);
+  g_free (export);
+}
+
+static const char *format_names[] = { "png", "jpeg", "webp" };
+
+const char * meme_export_format_get_extension (MemeExportFormat format) {
+  static const char *extensions[] = { "png", "jpg", "webp" };
+  g_return_val_if_fail (format <= MEME_EXPORT_WEBP, "png");
+  return extensions[format];
+}
+
+MemeExportFormat meme_export_format_from_path (const char *path) {
+  g_autofree char *lower = g_ascii_strdown (path, -1);
+  if (g_str_has_suffix (lower, ".jpg") || g_str_has_suffix (lower, ".jpeg")) return MEME_EXPORT_JPEG;
+  if (g_str_has_suffix (lower, ".webp")) return MEME_EXPORT_WEBP;
+  return MEME_EXPORT_PNG;
+}
+
+static gboolean format_is_writable (const char *name) {
+  GSList *formats = gdk_pixbuf_get_formats (), *l;
+  gboolean writable = FALSE;
+  for (l = formats; l; l = l->next) {
+    if (g_strcmp0 (gdk_pixbuf_format_get_name (l->data), name) == 0)
+      writable = gdk_pixbuf_format_is_writable (l->data);
+  }
+  g_slist_free (formats);
+  return writable;
+}
+
+static GdkPixbuf * flatten (GdkPixbuf *src) {
+  int w = gdk_pixbuf_get_width (src), h = gdk_pixbuf_get_height (src);
+  GdkPixbuf *dst = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, w, h);
+  gdk_pixbuf_fill (dst, 0xffffffff);
+  gdk_pixbuf_composite (src, dst, 0, 0, w, h, 0, 0, 1, 1, GDK_INTERP_NEAREST, 255);
+  return dst;
+}
+
+static GBytes * encode_at (GdkPixbuf *pixbuf, MemeExportFormat format, int quality, GError **error) {
+  gchar *buffer, value[4];
+  gsize length;
+  gboolean ok;
+
+  if (format == MEME_EXPORT_PNG) {
+    ok = gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &length, "png", error, NULL);
+  } else {
+    g_snprintf (value, sizeof value, "%d", quality);
+    ok = gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &length, format_names[format], error, "quality", value, NULL);
+  }
+  return ok ? g_bytes_new_take (buffer, length) : NULL;
+}
+
+GBytes * meme_export_encode (GdkPixbuf *pixbuf, const MemeExportOptions *options,
+                             GCancellable *cancellable, GError **error) {
+  MemeExportFormat format = options->format;
+  GdkPixbuf *flat = NULL;
+  GBytes *bytes, *best = NULL;
+  int lo = 1, hi = CLAMP (options->quality, 1, 100), quality;
+
+  g_return_val_if_fail (format <= MEME_EXPORT_WEBP, NULL);
+  if (format != MEME_EXPORT_PNG && !format_is_writable (format_names[format])) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "This system cannot save %s images", format == MEME_EXPORT_WEBP ? "WebP" : "JPEG");
+    return NULL;
+  }
+  if (format == MEME_EXPORT_JPEG && gdk_pixbuf_get_has_alpha (pixbuf)) pixbuf = flat = flatten (pixbuf);
+
+  bytes = encode_at (pixbuf, format, hi, error);
+  if (!bytes || options->max_bytes == 0 || g_bytes_get_size (bytes) <= options->max_bytes) goto out;
+  g_clear_pointer (&bytes, g_bytes_unref);
+
+  /* Everything above @hi is known to be too big; @best is the largest
+   * encode seen that fits. */
+  hi--;
+  while (format != MEME_EXPORT_PNG && lo <= hi) {
+    if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+      g_clear_pointer (&best, g_bytes_unref);
+      goto out;
+    }
+    quality = lo + (hi - lo) / 2;
+    bytes = encode_at (pixbuf, format, quality, error);
+    if (!bytes) {
+      g_clear_pointer (&best, g_bytes_unref);
+      goto out;
+    }
+    if (g_bytes_get_size (bytes) <= options->max_bytes) {
+      g_clear_pointer (&best, g_bytes_unref);
+      best = bytes;
+      lo = quality + 1;
+    } else {
+      g_bytes_unref (bytes);
+      hi = quality - 1;
+    }
+  }
+
+  bytes = best;
+  if (!bytes) {
+    g_autofree char *budget = g_format_size (options->max_bytes);
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+                 format == MEME_EXPORT_PNG ? "The image does not fit in %s as PNG; try JPEG or WebP"
+                                           : "The image does not fit in %s even at the lowest quality",
+                 budget);
+  }
+out:
+  g_clear_object (&flat);
+  return bytes;
+}
+
+/* Bands are about this many bytes of cairo ARGB. */
+#define EXPORT_BAND_BYTES (4 * 1024 * 1024)
+
+/* Renders @area band by band straight into the pixbuf that gets encoded, so
+ * next to the template only that pixbuf and one band are ever at full
+ * width. With @opaque the bands are laid onto white as they come, as
+ * meme_export_encode () would flatten a JPEG, instead of in another copy. */
+static GdkPixbuf * render_bands (ExportData *export, GdkPixbuf *bg, const cairo_rectangle_int_t *area,
+                                 gboolean opaque, GCancellable *cancellable, GError **error) {
+  GdkPixbuf *out = gdk_pixbuf_new (GDK_COLORSPACE_RGB, !opaque, 8, area->width, area->height);
+  int rows = MAX (64, EXPORT_BAND_BYTES / (area->width * 4)), y;
+
+  if (!out) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "Not enough memory to render the image");
+    return NULL;
+  }
+  if (opaque) gdk_pixbuf_fill (out, 0xffffffff);
+
+  for (y = 0; y < area->height; y += rows) {
+    cairo_rectangle_int_t band = { area->x, area->y + y, area->width, MIN (rows, area->height - y) };
+    cairo_surface_t *surface;
+    GdkPixbuf *strip;
+
+    /* The composite holds exactly a full render's pixels for any region. */
+    surface = meme_render_composite (bg, &export->geometry, export->layers, &band,
+                                     export->cinematic, export->deep_fry, export->seed, cancellable);
+    if (!surface) {
+      if (!g_cancellable_set_error_if_cancelled (cancellable, error))
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "Not enough memory to render the image");
+      g_object_unref (out);
+      return NULL;
+    }
+    /* The one unpremultiply on the way out of cairo, a band at a time. */
+    strip = gdk_pixbuf_get_from_surface (surface, 0, 0, band.width, band.height);
+    cairo_surface_destroy (surface);
+    if (opaque) gdk_pixbuf_composite (strip, out, 0, y, band.width, band.height, 0, y, 1, 1, GDK_INTERP_NEAREST, 255);
+    else gdk_pixbuf_copy_area (strip, 0, 0, band.width, band.height, out, 0, y);
+    g_object_unref (strip);
+  }
+  return out;
+}
+
+static void export_thread (GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable) {
+  ExportData *export = (ExportData *)task_data;
+  cairo_rectangle_int_t area;
+  GdkPixbuf *bg, *pixbuf;
+  GBytes *bytes;
+  GError *error = NULL;
+  gboolean ok;
+  int w, h;
+
+  if (g_task_return_error_if_cancelled (task)) return;
+  if (export->source_path) {
+    /* The only time the full-size original is in memory. */
+    bg = meme_pixbuf_load (export->source_path, 0, cancellable, &error);
+    if (!bg) {
+      g_task_return_error (task, error);
+      return;
+    }
+  } else {
+    bg = g_object_ref (export->bg);
+  }
+
+  meme_geometry_get_pixbuf_size (&export->geometry, bg, &w, &h);
+  area = (cairo_rectangle_int_t) { 0, 0, w, h };
+  if (export->has_crop) {
+    /* Only the cropped pixels are rendered and filtered. */
+    int x0 = MAX (0, (int)(export->crop.x * w)), y0 = MAX (0, (int)(export->crop.y * h));
+    int x1 = MIN (w, (int)(export->crop.x * w) + (int)(export->crop.width * w));
+    int y1 = MIN (h, (int)(export->crop.y * h) + (int)(export->crop.height * h));
+    area = (cairo_rectangle_int_t) { x0, y0, x1 - x0, y1 - y0 };
+  }
+  if (area.width <= 0 || area.height <= 0) {
+    g_object_unref (bg);
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "The crop area is empty");
+    return;
+  }
+
+  pixbuf = render_bands (export, bg, &area, export->options.format == MEME_EXPORT_JPEG, cancellable, &error);
+  /* The template (and its cairo copy, cached on it) goes before encoding. */
+  g_object_unref (bg);
+  if (!pixbuf) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  bytes = meme_export_encode (pixbuf, &export->options, cancellable, &error);
+  g_object_unref (pixbuf);
+  /* Written to a temporary file and renamed, so a failed export never
+   * leaves half an image behind. */
+  ok = bytes && g_file_replace_contents (export->file, g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                                         NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, cancellable, &error);
+  g_clear_pointer (&bytes, g_bytes_unref);
+  if (ok) g_task_return_boolean (task, TRUE);
+  else g_task_return_error (task, error);
+}
+
+void meme_export_async (GdkPixbuf *bg, const MemeGeometry *geometry, const char *source_path, MemeLayerStack *layers, gboolean cinematic, gboolean deep_fry, guint32 seed,
+                        const cairo_rectangle_t *crop, GFile *file, const MemeExportOptions *options,
+                        GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+  ExportData *export = g_new0 (ExportData, 1);
+
+  export->bg = g_object_ref (bg);
+  export->geometry = *geometry;
+  export->source_path = g_strdup (source_path);
+  export->layers = meme_layer_stack_copy (layers);
+  export->cinematic = cinematic;
+  export->deep_fry = deep_fry;
+  export->seed = seed;
+  export->has_crop = crop != NULL;
+  if (crop) export->crop = *crop;
+  export->file = g_object_ref (file);
+  export->options = *options;
+  g_task_set_source_tag (task, meme_export_async);
+  g_task_set_task_data (task, export, export_data_free);
+  g_task_run_in_thread (task, export_thread);
+  g_object_unref (task);
+}
+
+gboolean meme_export_finish (GAsyncResult *result, GError **error) {
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
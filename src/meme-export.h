@@ -0,0 +1,57 @@
+#pragma once
+#include "meme-layers.h"
+#include "meme-geometry.h"
+
+/* Export: the document is rendered at full size, encoded in memory and
+ * written out, all on a worker thread, so the window stays responsive.
+ *
+ * With a byte budget, a lossy format is encoded at the requested quality
+ * first and, if that is too big, binary-searched down to the highest
+ * quality that fits. Every attempt re-encodes the same rendered image, so
+ * the search costs at most seven extra encodes and no extra renders. PNG
+ * is lossless and is only checked against the budget. WebP needs a
+ * gdk-pixbuf saver for it, such as webp-pixbuf-loader. */
+
+typedef enum {
+  MEME_EXPORT_PNG,
+  MEME_EXPORT_JPEG,
+  MEME_EXPORT_WEBP,
+} MemeExportFormat;
+
+typedef struct {
+  MemeExportFormat format;
+  int quality;      /* 1-100; ignored for PNG */
+  gsize max_bytes;  /* 0 for no limit */
+} MemeExportOptions;
+
+#define MEME_EXPORT_DEFAULT_QUALITY 90
+
+const char *meme_export_format_get_extension (MemeExportFormat format);
+/* Guesses from the file name's extension, falling back to PNG. */
+MemeExportFormat meme_export_format_from_path (const char *path);
+
+/* Blocking; a JPEG's alpha channel is flattened onto white first. */
+GBytes *meme_export_encode (GdkPixbuf *pixbuf, const MemeExportOptions *options,
+                            GCancellable *cancellable, GError **error);
+
+/* @layers and @geometry are copied and @bg referenced, so editing can go
+ * on while the export runs. @crop is in fractions of the image, or NULL for
+ * all of it. With @source_path, @bg is only an editing proxy of the image
+ * there: the original is decoded on the worker and rendered in its place
+ * through the same geometry, with the layers scaled to match. The render
+ * goes band by band into the pixbuf that is encoded, and the original is
+ * dropped before encoding. */
+void meme_export_async (GdkPixbuf *bg,
+                        const MemeGeometry *geometry,
+                        const char *source_path,
+                        MemeLayerStack *layers,
+                        gboolean cinematic,
+                        gboolean deep_fry,
+                        guint32 seed,
+                        const cairo_rectangle_t *crop,
+                        GFile *file,
+                        const MemeExportOptions *options,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        gpointer user_data);
+gboolean meme_export_finish (GAsyncResult *result, GError **error);
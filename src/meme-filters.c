@@ -0,0 +1,325 @@
+#include "meme-filters.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MEME_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* out[c] = sum_k m[c][k] * in[k] + offset, in Q8. Rows and columns follow the
+ * order of the colour bytes in memory. The offset is applied through the
+ * alpha byte (o * alpha / 255), which is exactly right for premultiplied
+ * pixels; straight-alpha pixels use alpha = 255 for it instead. */
+typedef struct {
+  int n_channels;
+  int alpha;          /* byte index of alpha, -1 if none */
+  int color[3];       /* byte index of the three colour channels */
+  gboolean premultiplied;
+  gint16 m[3][3];
+  gint16 o;
+} ColorMatrix;
+
+typedef void (*ColorMatrixRowFunc) (guchar *row, int width, const ColorMatrix *cm);
+
+static gint16 to_q8 (double v) {
+  return (gint16)CLAMP (lround (v * 256.0), -32768, 32767);
+}
+
+static void color_matrix_init (ColorMatrix *cm, MemePixelLayout layout, double sat, double contrast) {
+  /* BT.601 luma weights, in R, G, B order. */
+  static const double luma[3] = { 0.299, 0.587, 0.114 };
+  int rgb_pos[3];
+  int j, k;
+
+  switch (layout) {
+    case MEME_PIXELS_RGB:
+      cm->n_channels = 3; cm->alpha = -1; cm->premultiplied = FALSE;
+      rgb_pos[0] = 0; rgb_pos[1] = 1; rgb_pos[2] = 2;
+      break;
+    case MEME_PIXELS_CAIRO:
+      cm->n_channels = 4; cm->premultiplied = TRUE;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+      cm->alpha = 3; rgb_pos[0] = 2; rgb_pos[1] = 1; rgb_pos[2] = 0;
+#else
+      cm->alpha = 0; rgb_pos[0] = 1; rgb_pos[1] = 2; rgb_pos[2] = 3;
+#endif
+      break;
+    case MEME_PIXELS_RGBA:
+    default:
+      cm->n_channels = 4; cm->alpha = 3; cm->premultiplied = FALSE;
+      rgb_pos[0] = 0; rgb_pos[1] = 1; rgb_pos[2] = 2;
+      break;
+  }
+
+  /* Colour bytes in memory order, and the luma weight of each. */
+  for (j = 0, k = 0; j < cm->n_channels; j++) {
+    if (j != cm->alpha) cm->color[k++] = j;
+  }
+
+  for (j = 0; j < 3; j++) {
+    for (k = 0; k < 3; k++) {
+      int channel = cm->color[k] == rgb_pos[0] ? 0 : (cm->color[k] == rgb_pos[1] ? 1 : 2);
+      double v = contrast * (1.0 - sat) * luma[channel];
+      if (j == k) v += contrast * sat;
+      cm->m[j][k] = to_q8 (v);
+    }
+  }
+  /* Scaled by 1/255 because it gets multiplied by alpha. */
+  cm->o = to_q8 (128.0 * (1.0 - contrast) / 255.0);
+}
+
+static inline guchar apply_row (const ColorMatrix *cm, int j, const guchar *p, int a) {
+  gint32 acc = cm->m[j][0] * p[cm->color[0]] + cm->m[j][1] * p[cm->color[1]] +
+               cm->m[j][2] * p[cm->color[2]] + cm->o * a + 128;
+  if (acc < 0) return 0;
+  acc >>= 8;
+  if (cm->premultiplied && acc > a) return (guchar)a;
+  return (guchar)MIN (acc, 255);
+}
+
+static void color_matrix_row_scalar (guchar *row, int width, const ColorMatrix *cm) {
+  int x;
+  for (x = 0; x < width; x++) {
+    guchar *p = row + x * cm->n_channels;
+    int a = (cm->alpha >= 0 && cm->premultiplied) ? p[cm->alpha] : 255;
+    guchar r0 = apply_row (cm, 0, p, a);
+    guchar r1 = apply_row (cm, 1, p, a);
+    guchar r2 = apply_row (cm, 2, p, a);
+    p[cm->color[0]] = r0; p[cm->color[1]] = r1; p[cm->color[2]] = r2;
+  }
+}
+
+#ifdef MEME_HAVE_X86_SIMD
+/* Four pixels per 128-bit lane. Colours 0/2 and 1/alpha are split into
+ * 16-bit pairs so each output channel is two pmaddwd; the results are packed
+ * back to planar bytes with saturation and re-interleaved. Every step is
+ * lane-local, so the AVX2 version is the same sequence on 256-bit vectors. */
+#define COLOR_MATRIX_PAIR(lo, hi) ((gint32)(((guint32)(guint16)(lo)) | ((guint32)(guint16)(hi) << 16)))
+
+static void color_matrix_row_sse2 (guchar *row, int width, const ColorMatrix *cm) {
+  const __m128i mask = _mm_set1_epi32 (0x00ff00ff);
+  const __m128i force_alpha = _mm_set1_epi32 (cm->premultiplied ? 0 : 0x00ff0000);
+  const __m128i round = _mm_set1_epi32 (128);
+  __m128i w02[3], w13[3];
+  int j, x = 0;
+
+  for (j = 0; j < 3; j++) {
+    w02[j] = _mm_set1_epi32 (COLOR_MATRIX_PAIR (cm->m[j][0], cm->m[j][2]));
+    w13[j] = _mm_set1_epi32 (COLOR_MATRIX_PAIR (cm->m[j][1], cm->o));
+  }
+
+  for (; x + 4 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *)(row + x * 4));
+    __m128i lo = _mm_and_si128 (v, mask);
+    __m128i hi = _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (v, 8), mask), force_alpha);
+    __m128i alpha = _mm_srli_epi32 (v, 24);
+    __m128i c0 = _mm_srai_epi32 (_mm_add_epi32 (_mm_add_epi32 (_mm_madd_epi16 (lo, w02[0]), _mm_madd_epi16 (hi, w13[0])), round), 8);
+    __m128i c1 = _mm_srai_epi32 (_mm_add_epi32 (_mm_add_epi32 (_mm_madd_epi16 (lo, w02[1]), _mm_madd_epi16 (hi, w13[1])), round), 8);
+    __m128i c2 = _mm_srai_epi32 (_mm_add_epi32 (_mm_add_epi32 (_mm_madd_epi16 (lo, w02[2]), _mm_madd_epi16 (hi, w13[2])), round), 8);
+    __m128i planar = _mm_packus_epi16 (_mm_packs_epi32 (c0, c1), _mm_packs_epi32 (c2, alpha));
+    __m128i ab = _mm_unpacklo_epi8 (planar, _mm_srli_si128 (planar, 4));
+    __m128i cd = _mm_unpacklo_epi8 (_mm_srli_si128 (planar, 8), _mm_srli_si128 (planar, 12));
+    __m128i out = _mm_unpacklo_epi16 (ab, cd);
+    if (cm->premultiplied) {
+      __m128i rep = _mm_or_si128 (_mm_or_si128 (alpha, _mm_slli_epi32 (alpha, 8)),
+                                  _mm_or_si128 (_mm_slli_epi32 (alpha, 16), _mm_slli_epi32 (alpha, 24)));
+      out = _mm_min_epu8 (out, rep);
+    }
+    _mm_storeu_si128 ((__m128i *)(row + x * 4), out);
+  }
+  color_matrix_row_scalar (row + x * 4, width - x, cm);
+}
+
+__attribute__((target ("avx2")))
+static void color_matrix_row_avx2 (guchar *row, int width, const ColorMatrix *cm) {
+  const __m256i mask = _mm256_set1_epi32 (0x00ff00ff);
+  const __m256i force_alpha = _mm256_set1_epi32 (cm->premultiplied ? 0 : 0x00ff0000);
+  const __m256i round = _mm256_set1_epi32 (128);
+  __m256i w02[3], w13[3];
+  int j, x = 0;
+
+  for (j = 0; j < 3; j++) {
+    w02[j] = _mm256_set1_epi32 (COLOR_MATRIX_PAIR (cm->m[j][0], cm->m[j][2]));
+    w13[j] = _mm256_set1_epi32 (COLOR_MATRIX_PAIR (cm->m[j][1], cm->o));
+  }
+
+  for (; x + 8 <= width; x += 8) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *)(row + x * 4));
+    __m256i lo = _mm256_and_si256 (v, mask);
+    __m256i hi = _mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (v, 8), mask), force_alpha);
+    __m256i alpha = _mm256_srli_epi32 (v, 24);
+    __m256i c0 = _mm256_srai_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (_mm256_madd_epi16 (lo, w02[0]), _mm256_madd_epi16 (hi, w13[0])), round), 8);
+    __m256i c1 = _mm256_srai_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (_mm256_madd_epi16 (lo, w02[1]), _mm256_madd_epi16 (hi, w13[1])), round), 8);
+    __m256i c2 = _mm256_srai_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (_mm256_madd_epi16 (lo, w02[2]), _mm256_madd_epi16 (hi, w13[2])), round), 8);
+    __m256i planar = _mm256_packus_epi16 (_mm256_packs_epi32 (c0, c1), _mm256_packs_epi32 (c2, alpha));
+    __m256i ab = _mm256_unpacklo_epi8 (planar, _mm256_srli_si256 (planar, 4));
+    __m256i cd = _mm256_unpacklo_epi8 (_mm256_srli_si256 (planar, 8), _mm256_srli_si256 (planar, 12));
+    __m256i out = _mm256_unpacklo_epi16 (ab, cd);
+    if (cm->premultiplied) {
+      __m256i rep = _mm256_or_si256 (_mm256_or_si256 (alpha, _mm256_slli_epi32 (alpha, 8)),
+                                     _mm256_or_si256 (_mm256_slli_epi32 (alpha, 16), _mm256_slli_epi32 (alpha, 24)));
+      out = _mm256_min_epu8 (out, rep);
+    }
+    _mm256_storeu_si256 ((__m256i *)(row + x * 4), out);
+  }
+  color_matrix_row_sse2 (row + x * 4, width - x, cm);
+}
+#endif
+
+static ColorMatrixRowFunc color_matrix_row_func (const ColorMatrix *cm) {
+#ifdef MEME_HAVE_X86_SIMD
+  static gsize simd_level = 0;
+  if (g_once_init_enter (&simd_level)) {
+    __builtin_cpu_init ();
+    g_once_init_leave (&simd_level, __builtin_cpu_supports ("avx2") ? 2 : 1);
+  }
+  /* The vector paths need four bytes per pixel with alpha last. */
+  if (cm->n_channels == 4 && cm->alpha == 3)
+    return simd_level == 2 ? color_matrix_row_avx2 : color_matrix_row_sse2;
+#endif
+  return color_matrix_row_scalar;
+}
+
+void meme_filter_saturation_contrast (guchar *pixels, int width, int height, int stride,
+                                      MemePixelLayout layout, double sat, double contrast) {
+  ColorMatrix cm;
+  ColorMatrixRowFunc row_func;
+  int y;
+
+  color_matrix_init (&cm, layout, sat, contrast);
+  row_func = color_matrix_row_func (&cm);
+  for (y = 0; y < height; y++) row_func (pixels + (gsize)y * stride, width, &cm);
+}
+
+/* lowbias32 (Chris Wellons): a cheap, well-mixed 32-bit integer hash. */
+static inline guint32 noise_hash (guint32 h) {
+  h ^= h >> 16; h *= 0x7feb352du;
+  h ^= h >> 15; h *= 0x846ca68bu;
+  h ^= h >> 16;
+  return h;
+}
+
+#define FRY_NOISE_LEVEL 30
+
+static inline guint32 fry_row_key (int ay, guint32 seed) {
+  return noise_hash ((guint32)ay ^ seed) ^ seed;
+}
+
+/* One hash per pixel; each channel takes 10 of its bits. */
+static inline void fry_pixel (const ColorMatrix *cm, guchar *p, int ax, guint32 row_key) {
+  guint32 h = noise_hash ((guint32)ax * 0x9e3779b1u ^ row_key);
+  int a = (cm->alpha >= 0 && cm->premultiplied) ? p[cm->alpha] : 255;
+  int k;
+
+  for (k = 0; k < 3; k++) {
+    int noise = (int)((((h >> (10 * k)) & 1023u) * (2 * FRY_NOISE_LEVEL + 1)) >> 10) - FRY_NOISE_LEVEL;
+    /* (v - 128) * 2 + 128, with the noise and the mid-grey premultiplied
+     * too, so translucent edges keep their colour instead of going black.
+     * Opaque pixels (and unpremultiplied layouts) take a = 255 exactly. */
+    int v = 2 * (p[cm->color[k]] + noise * a / 255) - 128 * a / 255;
+    p[cm->color[k]] = (guchar)CLAMP (v, 0, a);
+  }
+}
+
+int meme_filter_fry_cell_at (int p, double scale) {
+  return (int)floor ((p + 0.5) / (MEME_FILTER_FRY_BLOCK * scale));
+}
+
+int meme_filter_fry_cell_start (int cell, double scale) {
+  return (int)ceil (cell * MEME_FILTER_FRY_BLOCK * scale - 0.5);
+}
+
+/* The pixel a cell takes its colour from: the one over the cell's centre in
+ * the image, clipped to the part of the cell inside [@origin, @origin + @len).
+ * Returns a buffer index. */
+static inline int fry_sample (int cell, double scale, int origin, int len) {
+  int first = MAX (meme_filter_fry_cell_start (cell, scale), origin);
+  int last = MIN (meme_filter_fry_cell_start (cell + 1, scale), origin + len) - 1;
+  int centre = (int)floor ((cell * MEME_FILTER_FRY_BLOCK + MEME_FILTER_FRY_BLOCK / 2) * scale);
+  return CLAMP (centre, first, last) - origin;
+}
+
+/* The columns of one cell within the buffer. */
+typedef struct {
+  int cell;
+  int start;
+  int end;
+  int sample;
+} FrySpan;
+
+void meme_filter_post_process (guchar *pixels, int width, int height, int stride,
+                               MemePixelLayout layout, int x0, int y0, double scale_x, double scale_y,
+                               gboolean cinematic, gboolean deep_fry, guint32 seed) {
+  ColorMatrix cm;
+  ColorMatrixRowFunc row_func = NULL;
+  FrySpan *spans;
+  guchar *samples;
+  int n_channels, n_spans = 0, x, y, i;
+
+  if (width <= 0 || height <= 0) return;
+  if (!deep_fry) {
+    if (cinematic)
+      meme_filter_saturation_contrast (pixels, width, height, stride, layout,
+                                       MEME_CINEMATIC_SATURATION, MEME_CINEMATIC_CONTRAST);
+    return;
+  }
+
+  if (cinematic) {
+    color_matrix_init (&cm, layout, MEME_CINEMATIC_SATURATION, MEME_CINEMATIC_CONTRAST);
+    row_func = color_matrix_row_func (&cm);
+  } else {
+    color_matrix_init (&cm, layout, 1.0, 1.0);
+  }
+  n_channels = cm.n_channels;
+
+  /* Deep fry ends with a nearest-neighbour down/up scale, so every cell
+   * shows a single pixel. Only those samples are filtered, into a one-row
+   * scratch buffer, and then replicated over their cells in place. Cells
+   * and their grain are keyed by image coordinates, so bands filtered
+   * separately match a single pass and a scaled-down preview fries the same
+   * cells, with the same grain, as the full-size export. */
+  spans = g_new (FrySpan, width);
+  for (x = x0; x < x0 + width; n_spans++) {
+    FrySpan *span = &spans[n_spans];
+    span->cell = meme_filter_fry_cell_at (x, scale_x);
+    span->start = x - x0;
+    /* MAX guards against rounding ever leaving an empty span. */
+    x = MIN (MAX (meme_filter_fry_cell_start (span->cell + 1, scale_x), x + 1), x0 + width);
+    span->end = x - x0;
+    span->sample = fry_sample (span->cell, scale_x, x0, width);
+  }
+  samples = g_malloc ((gsize)n_spans * n_channels);
+
+  for (y = y0; y < y0 + height; ) {
+    int cy = meme_filter_fry_cell_at (y, scale_y);
+    int row_first = y - y0;
+    int row_end = MIN (MAX (meme_filter_fry_cell_start (cy + 1, scale_y), y + 1), y0 + height) - y0;
+    const guchar *src = pixels + (gsize)fry_sample (cy, scale_y, y0, height) * stride;
+    guint32 row_key = fry_row_key (cy * MEME_FILTER_FRY_BLOCK + MEME_FILTER_FRY_BLOCK / 2, seed);
+    int r;
+
+    for (i = 0; i < n_spans; i++)
+      memcpy (samples + i * n_channels, src + spans[i].sample * n_channels, n_channels);
+    if (row_func) row_func (samples, n_spans, &cm);
+    for (i = 0; i < n_spans; i++)
+      fry_pixel (&cm, samples + i * n_channels, spans[i].cell * MEME_FILTER_FRY_BLOCK + MEME_FILTER_FRY_BLOCK / 2, row_key);
+
+    for (r = row_first; r < row_end; r++) {
+      guchar *row = pixels + (gsize)r * stride;
+      for (i = 0; i < n_spans; i++) {
+        const guchar *sp = samples + i * n_channels;
+        if (n_channels == 4) {
+          guint32 v;
+          memcpy (&v, sp, 4);
+          for (x = spans[i].start; x < spans[i].end; x++) memcpy (row + x * 4, &v, 4);
+        } else {
+          for (x = spans[i].start; x < spans[i].end; x++) memcpy (row + x * n_channels, sp, n_channels);
+        }
+      }
+    }
+    y = row_end + y0;
+  }
+  g_free (samples);
+  g_free (spans);
+}
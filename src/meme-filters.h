@@ -0,0 +1,43 @@
+#pragma once
+#include <glib.h>
+
+/* Per-pixel filter kernels working on raw, caller-owned buffers in place. */
+
+typedef enum {
+  MEME_PIXELS_RGB,    /* GdkPixbuf without alpha */
+  MEME_PIXELS_RGBA,   /* GdkPixbuf with alpha (not premultiplied) */
+  MEME_PIXELS_CAIRO   /* CAIRO_FORMAT_ARGB32: native-endian, premultiplied */
+} MemePixelLayout;
+
+#define MEME_CINEMATIC_SATURATION 1.15
+#define MEME_CINEMATIC_CONTRAST   1.05
+
+/* Saturation and contrast in Q8 fixed point, SSE2/AVX2 where the CPU has it.
+ * All code paths produce bit-identical output. */
+void meme_filter_saturation_contrast (guchar *pixels, int width, int height, int stride,
+                                      MemePixelLayout layout, double sat, double contrast);
+
+/* Deep fry pixelates in cells of this many pixels, aligned to the image. */
+#define MEME_FILTER_FRY_BLOCK 4
+
+/* The cell grid as seen at @scale output pixels per image pixel: an output
+ * pixel belongs to the cell under its centre, so the grid stays anchored to
+ * the image at any zoom. At a scale of 1 a cell is MEME_FILTER_FRY_BLOCK
+ * pixels; cell_start () is the first output pixel at or after the cell's
+ * top-left edge. */
+int meme_filter_fry_cell_at (int p, double scale);
+int meme_filter_fry_cell_start (int cell, double scale);
+
+/* The whole cinematic/deep-fry chain in one in-place pass. When deep fry is
+ * on, only one pixel per cell is filtered (the pixelation step would
+ * discard the rest), so the only allocations are a row of samples and of
+ * cell spans. @x0/@y0 give the buffer's position in the output, both >= 0,
+ * and @scale_x/@scale_y the output's size relative to the image (1 for
+ * full size, less for a preview). The buffer must not cut through a cell
+ * that other calls also cover, or the halves may pick different samples.
+ * The deep-fry grain comes from a counter-based hash of (cell, channel,
+ * @seed) rather than a global PRNG, so bands can run on any thread and the
+ * same document always fries the same way at any scale. */
+void meme_filter_post_process (guchar *pixels, int width, int height, int stride,
+                               MemePixelLayout layout, int x0, int y0, double scale_x, double scale_y,
+                               gboolean cinematic, gboolean deep_fry, guint32 seed);
@@ -0,0 +1,109 @@
+#include "meme-geometry.h"
+#include "meme-raster.h"
+#include <math.h>
+
+static gboolean geometry_swaps_axes (const MemeGeometry *geometry) {
+  return geometry->xx == 0;
+}
+
+static int oriented_width (const MemeGeometry *geometry) {
+  return geometry_swaps_axes (geometry) ? geometry->source_height : geometry->source_width;
+}
+
+static int oriented_height (const MemeGeometry *geometry) {
+  return geometry_swaps_axes (geometry) ? geometry->source_width : geometry->source_height;
+}
+
+/* Applies [a b; c d] after the current orientation. */
+static void geometry_orient (MemeGeometry *geometry, int a, int b, int c, int d) {
+  int xx = geometry->xx, xy = geometry->xy, yx = geometry->yx, yy = geometry->yy;
+  geometry->xx = a * xx + b * yx;
+  geometry->xy = a * xy + b * yy;
+  geometry->yx = c * xx + d * yx;
+  geometry->yy = c * xy + d * yy;
+}
+
+void meme_geometry_init (MemeGeometry *geometry, int source_width, int source_height) {
+  *geometry = (MemeGeometry) { source_width, source_height, 1, 0, 0, 1, { 0, 0, source_width, source_height } };
+}
+
+gboolean meme_geometry_equal (const MemeGeometry *a, const MemeGeometry *b) {
+  return a->source_width == b->source_width && a->source_height == b->source_height &&
+         a->xx == b->xx && a->xy == b->xy && a->yx == b->yx && a->yy == b->yy &&
+         a->crop.x == b->crop.x && a->crop.y == b->crop.y &&
+         a->crop.width == b->crop.width && a->crop.height == b->crop.height;
+}
+
+int meme_geometry_get_width (const MemeGeometry *geometry) {
+  return geometry->crop.width;
+}
+
+int meme_geometry_get_height (const MemeGeometry *geometry) {
+  return geometry->crop.height;
+}
+
+/* Turning the oriented image turns the crop with it. */
+void meme_geometry_rotate (MemeGeometry *geometry, gboolean clockwise) {
+  cairo_rectangle_int_t r = geometry->crop;
+  int ow = oriented_width (geometry), oh = oriented_height (geometry);
+
+  if (clockwise) {
+    geometry_orient (geometry, 0, -1, 1, 0);
+    geometry->crop = (cairo_rectangle_int_t) { oh - r.y - r.height, r.x, r.height, r.width };
+  } else {
+    geometry_orient (geometry, 0, 1, -1, 0);
+    geometry->crop = (cairo_rectangle_int_t) { r.y, ow - r.x - r.width, r.height, r.width };
+  }
+}
+
+void meme_geometry_flip (MemeGeometry *geometry, gboolean horizontal) {
+  if (horizontal) {
+    geometry_orient (geometry, -1, 0, 0, 1);
+    geometry->crop.x = oriented_width (geometry) - geometry->crop.x - geometry->crop.width;
+  } else {
+    geometry_orient (geometry, 1, 0, 0, -1);
+    geometry->crop.y = oriented_height (geometry) - geometry->crop.y - geometry->crop.height;
+  }
+}
+
+void meme_geometry_crop (MemeGeometry *geometry, const cairo_rectangle_int_t *rect) {
+  int x0 = CLAMP (rect->x, 0, geometry->crop.width), y0 = CLAMP (rect->y, 0, geometry->crop.height);
+  int x1 = CLAMP (rect->x + rect->width, 0, geometry->crop.width);
+  int y1 = CLAMP (rect->y + rect->height, 0, geometry->crop.height);
+
+  if (x1 <= x0 || y1 <= y0) return;
+  geometry->crop.x += x0;
+  geometry->crop.y += y0;
+  geometry->crop.width = x1 - x0;
+  geometry->crop.height = y1 - y0;
+}
+
+double meme_geometry_get_pixbuf_scale (const MemeGeometry *geometry, GdkPixbuf *pixbuf) {
+  return (double)gdk_pixbuf_get_width (pixbuf) / geometry->source_width;
+}
+
+void meme_geometry_get_pixbuf_size (const MemeGeometry *geometry, GdkPixbuf *pixbuf, int *width, int *height) {
+  double scale = meme_geometry_get_pixbuf_scale (geometry, pixbuf);
+  *width = MAX (1, (int)round (geometry->crop.width * scale));
+  *height = MAX (1, (int)round (geometry->crop.height * scale));
+}
+
+/* Result pixel -> oriented pixel (add the crop origin) -> about the centre
+ * -> back through the orientation, whose inverse is its transpose -> source
+ * pixel -> @pixbuf pixel. */
+void meme_geometry_set_source (cairo_t *cr, const MemeGeometry *geometry, GdkPixbuf *pixbuf) {
+  double kx = (double)gdk_pixbuf_get_width (pixbuf) / geometry->source_width;
+  double ky = (double)gdk_pixbuf_get_height (pixbuf) / geometry->source_height;
+  double ox = geometry->crop.x - oriented_width (geometry) / 2.0;
+  double oy = geometry->crop.y - oriented_height (geometry) / 2.0;
+  cairo_matrix_t m;
+
+  cairo_matrix_init (&m,
+                     kx * geometry->xx, ky * geometry->xy,
+                     kx * geometry->yx, ky * geometry->yy,
+                     kx * (geometry->xx * ox + geometry->yx * oy + geometry->source_width / 2.0),
+                     ky * (geometry->xy * ox + geometry->yy * oy + geometry->source_height / 2.0));
+  meme_raster_set_source_matrix (cr, pixbuf, &m);
+  /* A scaled-up original must not fade out towards the edges. */
+  cairo_pattern_set_extend (cairo_get_source (cr), CAIRO_EXTEND_PAD);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "meme-core.h"
+
+/* Rotate, flip and crop as a transform instead of new pixels.
+ *
+ * The template's own pixels are never touched. A geometry composes every
+ * rotation, flip and crop made so far into one orientation (a quarter-turn
+ * rotation, possibly mirrored) and one crop rectangle, so each operation is
+ * O(1) and undoes by value, and rendering resamples the template once,
+ * however many times it was turned. Crops are kept in whole pixels of the
+ * oriented template, so at the template's own size the transform only
+ * moves pixels around and costs no sharpness at all. */
+
+typedef struct {
+  int source_width;           /* the template the geometry was made for */
+  int source_height;
+  int xx, xy, yx, yy;         /* orientation, source to oriented, about the centre */
+  cairo_rectangle_int_t crop; /* in oriented pixels */
+} MemeGeometry;
+
+void meme_geometry_init (MemeGeometry *geometry, int source_width, int source_height);
+gboolean meme_geometry_equal (const MemeGeometry *a, const MemeGeometry *b);
+
+/* The size of the result, which is what layers are laid out on. */
+int meme_geometry_get_width (const MemeGeometry *geometry);
+int meme_geometry_get_height (const MemeGeometry *geometry);
+
+void meme_geometry_rotate (MemeGeometry *geometry, gboolean clockwise);
+void meme_geometry_flip (MemeGeometry *geometry, gboolean horizontal);
+/* @rect is in pixels of the current result; it is clipped to it, and an
+ * empty rectangle is ignored. */
+void meme_geometry_crop (MemeGeometry *geometry, const cairo_rectangle_int_t *rect);
+
+/* @pixbuf may be a larger decode of the image the geometry was made for
+ * (the original behind an editing proxy); the result is larger by the same
+ * factor. */
+double meme_geometry_get_pixbuf_scale (const MemeGeometry *geometry, GdkPixbuf *pixbuf);
+void meme_geometry_get_pixbuf_size (const MemeGeometry *geometry, GdkPixbuf *pixbuf, int *width, int *height);
+
+/* Sets @pixbuf as @cr's source, transformed so that user space is in
+ * result pixels; scale @cr by meme_geometry_get_pixbuf_scale () to draw a
+ * larger @pixbuf at its own resolution. */
+void meme_geometry_set_source (cairo_t *cr, const MemeGeometry *geometry, GdkPixbuf *pixbuf);
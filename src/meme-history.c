@@ -0,0 +1,254 @@
+#include "meme-history.h"
+#include <string.h>
+
+typedef enum {
+  COMMAND_MODIFY,
+  COMMAND_INSERT,
+  COMMAND_REMOVE,
+  COMMAND_MOVE,
+  COMMAND_GEOMETRY
+} CommandKind;
+
+typedef struct {
+  CommandKind kind;
+  MemeLayerId id;      /* MODIFY/INSERT/MOVE: the layer in the stack */
+  ImageLayer state;    /* MODIFY: the other version of the layer's fields; REMOVE: the removed layer */
+  int index;           /* REMOVE: where to put the layer back; MOVE: the other position */
+  MemeGeometry geometry; /* GEOMETRY: the other geometry */
+} Command;
+
+typedef struct {
+  GArray *commands;
+  gsize bytes;
+} Step;
+
+struct _MemeHistory {
+  GQueue undo;         /* newest step at the head */
+  GQueue redo;
+  Step *pending;
+  int depth;
+  gsize budget;
+  gsize bytes;
+};
+
+/* MODIFY and REMOVE hold references through @state; INSERT's layer is in
+ * the stack until the command is applied. */
+static void command_clear (gpointer data) {
+  Command *cmd = (Command *)data;
+  switch (cmd->kind) {
+    case COMMAND_MODIFY:
+    case COMMAND_REMOVE:
+      meme_layer_clear (&cmd->state);
+      break;
+    case COMMAND_INSERT:
+    case COMMAND_MOVE:
+    case COMMAND_GEOMETRY:
+      break;
+  }
+}
+
+static gsize pixbuf_cost (GdkPixbuf *pixbuf) {
+  return pixbuf ? gdk_pixbuf_get_byte_length (pixbuf) : 0;
+}
+
+/* What a layer costs while only the history keeps it alive. */
+static gsize detached_cost (const ImageLayer *layer) {
+  return pixbuf_cost (layer->content.pixbuf) + (layer->content.text ? g_ref_string_length (layer->content.text) : 0);
+}
+
+static void step_free (gpointer data) {
+  Step *step = (Step *)data;
+  g_array_unref (step->commands);
+  g_free (step);
+}
+
+MemeHistory * meme_history_new (gsize budget_bytes) {
+  MemeHistory *history = g_new0 (MemeHistory, 1);
+  g_queue_init (&history->undo);
+  g_queue_init (&history->redo);
+  history->budget = budget_bytes;
+  return history;
+}
+
+static void history_clear_redo (MemeHistory *history) {
+  Step *step;
+  while ((step = g_queue_pop_head (&history->redo))) {
+    history->bytes -= step->bytes;
+    step_free (step);
+  }
+}
+
+void meme_history_clear (MemeHistory *history) {
+  Step *step;
+  history_clear_redo (history);
+  while ((step = g_queue_pop_head (&history->undo))) step_free (step);
+  g_clear_pointer (&history->pending, step_free);
+  history->depth = 0;
+  history->bytes = 0;
+}
+
+void meme_history_free (MemeHistory *history) {
+  if (!history) return;
+  meme_history_clear (history);
+  g_free (history);
+}
+
+/* Drops the steps furthest from the present, the oldest undo steps first,
+ * until the history fits its budget. @keep, the step just recorded or
+ * applied, always stays, however large. */
+static void history_trim (MemeHistory *history, Step *keep) {
+  while (history->bytes > history->budget) {
+    GQueue *queue = &history->undo;
+    Step *step;
+
+    if (!queue->length || g_queue_peek_tail (queue) == keep) queue = &history->redo;
+    if (!queue->length || g_queue_peek_tail (queue) == keep) break;
+    step = g_queue_pop_tail (queue);
+    history->bytes -= step->bytes;
+    step_free (step);
+  }
+}
+
+void meme_history_begin (MemeHistory *history) {
+  if (history->depth++ > 0) return;
+  history->pending = g_new0 (Step, 1);
+  history->pending->commands = g_array_new (FALSE, TRUE, sizeof (Command));
+  g_array_set_clear_func (history->pending->commands, command_clear);
+}
+
+void meme_history_end (MemeHistory *history) {
+  Step *step;
+
+  g_return_if_fail (history->depth > 0);
+  if (--history->depth > 0) return;
+
+  step = g_steal_pointer (&history->pending);
+  if (step->commands->len == 0) { step_free (step); return; }
+
+  g_queue_push_head (&history->undo, step);
+  history->bytes += step->bytes;
+  history_trim (history, step);
+}
+
+static void history_push (MemeHistory *history, const Command *cmd, gsize extra_bytes) {
+  /* A new edit forks the timeline; whatever could be redone is gone. */
+  history_clear_redo (history);
+  meme_history_begin (history);
+  g_array_append_vals (history->pending->commands, cmd, 1);
+  history->pending->bytes += sizeof (Command) + extra_bytes;
+  meme_history_end (history);
+}
+
+void meme_history_record_modify (MemeHistory *history, MemeLayerStack *layers, MemeLayerId id) {
+  Command cmd = { COMMAND_MODIFY, id };
+  LayerGeometry *geometry;
+  LayerContent *content;
+
+  if (!meme_layer_stack_lookup (layers, id, &geometry, &content)) return;
+  cmd.state.geometry = *geometry;
+  meme_layer_content_init_copy (&cmd.state.content, content);
+  history_push (history, &cmd, 0);
+}
+
+void meme_history_record_insert (MemeHistory *history, MemeLayerId id) {
+  Command cmd = { COMMAND_INSERT, id };
+  history_push (history, &cmd, 0);
+}
+
+void meme_history_record_remove (MemeHistory *history, MemeLayerStack *layers, MemeLayerId id) {
+  Command cmd = { COMMAND_REMOVE, id };
+
+  cmd.index = meme_layer_stack_find (layers, id);
+  if (!meme_layer_stack_take (layers, id, &cmd.state)) return;
+  /* Only a removed layer is kept alive by the history alone. */
+  history_push (history, &cmd, detached_cost (&cmd.state));
+}
+
+void meme_history_record_move (MemeHistory *history, MemeLayerStack *layers, MemeLayerId id, guint position) {
+  Command cmd = { COMMAND_MOVE, id };
+
+  cmd.index = meme_layer_stack_find (layers, id);
+  if (cmd.index < 0) return;
+  meme_layer_stack_move (layers, id, position);
+  if (meme_layer_stack_find (layers, id) == cmd.index) return;
+  history_push (history, &cmd, 0);
+}
+
+void meme_history_record_geometry (MemeHistory *history, const MemeGeometry *geometry) {
+  Command cmd = { COMMAND_GEOMETRY };
+
+  cmd.geometry = *geometry;
+  history_push (history, &cmd, 0);
+}
+
+/* Reverts @cmd and leaves behind the command that reverts that. A layer
+ * moving between the stack and the command changes what the history keeps
+ * alive; the change is added to @step's and the history's bytes. */
+static void command_apply (MemeHistory *history, Step *step, Command *cmd, MemeLayerStack *layers, MemeGeometry *geometry) {
+  LayerGeometry *layer;
+  LayerContent *content;
+  ImageLayer tmp;
+  MemeGeometry other;
+  int position;
+
+  switch (cmd->kind) {
+    case COMMAND_MODIFY:
+      if (!meme_layer_stack_lookup (layers, cmd->id, &layer, &content)) break;
+      tmp.geometry = *layer;
+      tmp.content = *content;
+      *layer = cmd->state.geometry;
+      *content = cmd->state.content;
+      cmd->state = tmp;
+      break;
+    case COMMAND_INSERT:
+      cmd->index = meme_layer_stack_find (layers, cmd->id);
+      if (!meme_layer_stack_take (layers, cmd->id, &cmd->state)) break;
+      cmd->kind = COMMAND_REMOVE;
+      step->bytes += detached_cost (&cmd->state);
+      history->bytes += detached_cost (&cmd->state);
+      break;
+    case COMMAND_REMOVE:
+      step->bytes -= detached_cost (&cmd->state);
+      history->bytes -= detached_cost (&cmd->state);
+      meme_layer_stack_insert (layers, cmd->index, &cmd->state);
+      /* The stack took over the references. */
+      memset (&cmd->state, 0, sizeof (cmd->state));
+      cmd->kind = COMMAND_INSERT;
+      break;
+    case COMMAND_MOVE:
+      position = meme_layer_stack_find (layers, cmd->id);
+      if (position < 0) break;
+      meme_layer_stack_move (layers, cmd->id, cmd->index);
+      cmd->index = position;
+      break;
+    case COMMAND_GEOMETRY:
+      other = *geometry;
+      *geometry = cmd->geometry;
+      cmd->geometry = other;
+      break;
+  }
+}
+
+gboolean meme_history_undo (MemeHistory *history, MemeLayerStack *layers, MemeGeometry *geometry) {
+  Step *step = g_queue_pop_head (&history->undo);
+  guint i;
+
+  if (!step) return FALSE;
+  for (i = step->commands->len; i > 0; i--)
+    command_apply (history, step, &g_array_index (step->commands, Command, i - 1), layers, geometry);
+  g_queue_push_head (&history->redo, step);
+  history_trim (history, step);
+  return TRUE;
+}
+
+gboolean meme_history_redo (MemeHistory *history, MemeLayerStack *layers, MemeGeometry *geometry) {
+  Step *step = g_queue_pop_head (&history->redo);
+  guint i;
+
+  if (!step) return FALSE;
+  for (i = 0; i < step->commands->len; i++)
+    command_apply (history, step, &g_array_index (step->commands, Command, i), layers, geometry);
+  g_queue_push_head (&history->undo, step);
+  history_trim (history, step);
+  return TRUE;
+}
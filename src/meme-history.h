@@ -0,0 +1,43 @@
+#pragma once
+#include "meme-layers.h"
+#include "meme-geometry.h"
+
+/* Undo/redo as a log of small commands instead of whole-document snapshots.
+ *
+ * Each command records one change (a layer's fields, a layer added,
+ * removed or moved, the template's geometry), so an edit costs one ImageLayer-sized
+ * record; text and pixbufs are shared by reference, never copied. Layers are
+ * addressed by id, so commands survive the stack reallocating or reordering. Applying
+ * a command turns it into its own inverse, which is what lets the same
+ * record move between the undo and redo stacks.
+ *
+ * The history is bounded by @budget_bytes rather than a step count: the
+ * steps furthest from the present, oldest undo first, are dropped once the
+ * records (plus any detached layers they keep alive) exceed it. Undo and
+ * redo recount a step as layers move between it and the stack. */
+
+#define MEME_HISTORY_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+typedef struct _MemeHistory MemeHistory;
+
+MemeHistory *meme_history_new (gsize budget_bytes);
+void meme_history_free (MemeHistory *history);
+void meme_history_clear (MemeHistory *history);
+
+/* Commands recorded between begin and end undo as a single step. */
+void meme_history_begin (MemeHistory *history);
+void meme_history_end (MemeHistory *history);
+
+/* Call before changing the fields of layer @id. */
+void meme_history_record_modify (MemeHistory *history, MemeLayerStack *layers, MemeLayerId id);
+/* Call after layer @id was added to the stack. */
+void meme_history_record_insert (MemeHistory *history, MemeLayerId id);
+/* Removes layer @id from @layers, keeping it in the history. */
+void meme_history_record_remove (MemeHistory *history, MemeLayerStack *layers, MemeLayerId id);
+/* Moves layer @id to @position in @layers, recording where it was. */
+void meme_history_record_move (MemeHistory *history, MemeLayerStack *layers, MemeLayerId id, guint position);
+/* Call before changing the template's geometry. */
+void meme_history_record_geometry (MemeHistory *history, const MemeGeometry *geometry);
+
+gboolean meme_history_undo (MemeHistory *history, MemeLayerStack *layers, MemeGeometry *geometry);
+gboolean meme_history_redo (MemeHistory *history, MemeLayerStack *layers, MemeGeometry *geometry);
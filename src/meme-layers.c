@@ -0,0 +1,167 @@
+#include "meme-layers.h"
+#include <string.h>
+
+struct _MemeLayerStack {
+  GArray *geometry;    /* LayerGeometry, by slot */
+  GArray *content;     /* LayerContent, parallel to geometry */
+  GArray *order;       /* slot numbers, bottom to top */
+  GArray *positions;   /* position in order, by slot */
+  GHashTable *index;   /* MemeLayerId -> slot + 1 */
+  MemeLayerId next_id;
+};
+
+#define SLOT_AT(stack, position) g_array_index ((stack)->order, guint, position)
+
+/* Points positions[] back at order[from..to). */
+static void stack_reposition (MemeLayerStack *stack, guint from, guint to) {
+  guint i;
+  for (i = from; i < to && i < stack->order->len; i++)
+    g_array_index (stack->positions, guint, SLOT_AT (stack, i)) = i;
+}
+
+static int stack_slot (MemeLayerStack *stack, MemeLayerId id) {
+  return GPOINTER_TO_INT (g_hash_table_lookup (stack->index, GUINT_TO_POINTER (id))) - 1;
+}
+
+MemeLayerStack * meme_layer_stack_new (void) {
+  MemeLayerStack *stack = g_new0 (MemeLayerStack, 1);
+  stack->geometry = g_array_new (FALSE, TRUE, sizeof (LayerGeometry));
+  stack->content = g_array_new (FALSE, TRUE, sizeof (LayerContent));
+  stack->order = g_array_new (FALSE, FALSE, sizeof (guint));
+  stack->positions = g_array_new (FALSE, FALSE, sizeof (guint));
+  stack->index = g_hash_table_new (NULL, NULL);
+  stack->next_id = 1;
+  return stack;
+}
+
+void meme_layer_stack_clear (MemeLayerStack *stack) {
+  guint i;
+  for (i = 0; i < stack->content->len; i++) meme_layer_content_clear (&g_array_index (stack->content, LayerContent, i));
+  g_array_set_size (stack->geometry, 0);
+  g_array_set_size (stack->content, 0);
+  g_array_set_size (stack->order, 0);
+  g_array_set_size (stack->positions, 0);
+  g_hash_table_remove_all (stack->index);
+}
+
+void meme_layer_stack_free (MemeLayerStack *stack) {
+  if (!stack) return;
+  meme_layer_stack_clear (stack);
+  g_array_unref (stack->geometry);
+  g_array_unref (stack->content);
+  g_array_unref (stack->order);
+  g_array_unref (stack->positions);
+  g_hash_table_unref (stack->index);
+  g_free (stack);
+}
+
+MemeLayerStack * meme_layer_stack_copy (MemeLayerStack *stack) {
+  MemeLayerStack *copy = meme_layer_stack_new ();
+  guint i, n = stack->geometry->len;
+
+  g_array_append_vals (copy->geometry, stack->geometry->data, n);
+  g_array_set_size (copy->content, n);
+  for (i = 0; i < n; i++) {
+    meme_layer_content_init_copy (&g_array_index (copy->content, LayerContent, i),
+                                  &g_array_index (stack->content, LayerContent, i));
+    g_hash_table_insert (copy->index, GUINT_TO_POINTER (g_array_index (copy->geometry, LayerGeometry, i).id),
+                         GUINT_TO_POINTER (i + 1));
+  }
+  g_array_append_vals (copy->order, stack->order->data, n);
+  g_array_append_vals (copy->positions, stack->positions->data, n);
+  copy->next_id = stack->next_id;
+  return copy;
+}
+
+guint meme_layer_stack_get_n_layers (const MemeLayerStack *stack) {
+  return stack->order->len;
+}
+
+LayerGeometry * meme_layer_stack_get_geometry (MemeLayerStack *stack, guint position) {
+  g_return_val_if_fail (position < stack->order->len, NULL);
+  return &g_array_index (stack->geometry, LayerGeometry, SLOT_AT (stack, position));
+}
+
+LayerContent * meme_layer_stack_get_content (MemeLayerStack *stack, guint position) {
+  g_return_val_if_fail (position < stack->order->len, NULL);
+  return &g_array_index (stack->content, LayerContent, SLOT_AT (stack, position));
+}
+
+gboolean meme_layer_stack_lookup (MemeLayerStack *stack, MemeLayerId id,
+                                  LayerGeometry **geometry, LayerContent **content) {
+  int slot = id ? stack_slot (stack, id) : -1;
+
+  if (geometry) *geometry = slot < 0 ? NULL : &g_array_index (stack->geometry, LayerGeometry, slot);
+  if (content) *content = slot < 0 ? NULL : &g_array_index (stack->content, LayerContent, slot);
+  return slot >= 0;
+}
+
+int meme_layer_stack_find (MemeLayerStack *stack, MemeLayerId id) {
+  int slot = stack_slot (stack, id);
+  return slot < 0 ? -1 : (int)g_array_index (stack->positions, guint, slot);
+}
+
+MemeLayerId meme_layer_stack_insert (MemeLayerStack *stack, int position, const ImageLayer *layer) {
+  LayerGeometry geometry = layer->geometry;
+  guint slot = stack->geometry->len, at;
+
+  at = position < 0 || (guint)position > stack->order->len ? stack->order->len : (guint)position;
+  if (geometry.id == 0) geometry.id = stack->next_id++;
+  g_return_val_if_fail (stack_slot (stack, geometry.id) < 0, 0);
+
+  /* New records always go at the end of storage; only the order shifts. */
+  g_array_append_val (stack->geometry, geometry);
+  g_array_append_vals (stack->content, &layer->content, 1);
+  g_array_append_val (stack->positions, at);
+  g_array_insert_val (stack->order, at, slot);
+  g_hash_table_insert (stack->index, GUINT_TO_POINTER (geometry.id), GUINT_TO_POINTER (slot + 1));
+  stack_reposition (stack, at + 1, stack->order->len);
+  return geometry.id;
+}
+
+gboolean meme_layer_stack_take (MemeLayerStack *stack, MemeLayerId id, ImageLayer *out) {
+  int slot = stack_slot (stack, id);
+  guint position, last;
+
+  if (slot < 0) return FALSE;
+  position = g_array_index (stack->positions, guint, slot);
+  out->geometry = g_array_index (stack->geometry, LayerGeometry, slot);
+  out->content = g_array_index (stack->content, LayerContent, slot);
+  g_array_remove_index (stack->order, position);
+  stack_reposition (stack, position, stack->order->len);
+  g_hash_table_remove (stack->index, GUINT_TO_POINTER (id));
+
+  /* The last slot fills the hole, so storage stays dense. */
+  last = stack->geometry->len - 1;
+  if ((guint)slot != last) {
+    LayerGeometry *moved = &g_array_index (stack->geometry, LayerGeometry, last);
+    guint moved_position = g_array_index (stack->positions, guint, last);
+    g_array_index (stack->geometry, LayerGeometry, slot) = *moved;
+    g_array_index (stack->content, LayerContent, slot) = g_array_index (stack->content, LayerContent, last);
+    g_array_index (stack->positions, guint, slot) = moved_position;
+    SLOT_AT (stack, moved_position) = slot;
+    g_hash_table_insert (stack->index, GUINT_TO_POINTER (moved->id), GUINT_TO_POINTER (slot + 1));
+  }
+  g_array_set_size (stack->geometry, last);
+  g_array_set_size (stack->content, last);
+  g_array_set_size (stack->positions, last);
+  return TRUE;
+}
+
+void meme_layer_stack_move (MemeLayerStack *stack, MemeLayerId id, guint position) {
+  int slot = stack_slot (stack, id);
+  guint from;
+
+  if (slot < 0) return;
+  from = g_array_index (stack->positions, guint, slot);
+  position = MIN (position, stack->order->len - 1);
+  if (from == position) return;
+
+  /* Only the slot numbers in between shift; one step is a swap. */
+  if (from < position)
+    memmove (&SLOT_AT (stack, from), &SLOT_AT (stack, from + 1), (position - from) * sizeof (guint));
+  else
+    memmove (&SLOT_AT (stack, position + 1), &SLOT_AT (stack, position), (from - position) * sizeof (guint));
+  SLOT_AT (stack, position) = slot;
+  stack_reposition (stack, MIN (from, position), MAX (from, position) + 1);
+}
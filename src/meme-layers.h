@@ -0,0 +1,45 @@
+#pragma once
+#include "meme-core.h"
+
+/* The document's layers, bottom to top.
+ *
+ * Records live in two parallel arrays of storage slots: the geometry every
+ * layer has (what render culling, hit-testing and bounds walk over) packed
+ * on its own, and the content (text, pixbuf, styling) beside it, so the hot
+ * loops never pull text or pixel pointers through the cache. The z-order
+ * is a separate array of slot numbers, so reordering moves indices, never
+ * records. Layers are referred to by a MemeLayerId that stays valid across
+ * everything; the pointers handed out stay valid across moves and are only
+ * invalidated by the next insert or take.
+ *
+ * Appending, lookup by id and position, and moving a layer one step are
+ * O(1); inserting below the top, taking and moving further shift slot
+ * numbers (not records) in proportion to the distance. */
+
+typedef struct _MemeLayerStack MemeLayerStack;
+
+MemeLayerStack *meme_layer_stack_new (void);
+void meme_layer_stack_free (MemeLayerStack *stack);
+void meme_layer_stack_clear (MemeLayerStack *stack);
+/* Deep copy with the same ids; text and pixbufs are shared by reference,
+ * so the copy is cheap and safe to hand to another thread. */
+MemeLayerStack *meme_layer_stack_copy (MemeLayerStack *stack);
+
+guint meme_layer_stack_get_n_layers (const MemeLayerStack *stack);
+LayerGeometry *meme_layer_stack_get_geometry (MemeLayerStack *stack, guint position);
+LayerContent *meme_layer_stack_get_content (MemeLayerStack *stack, guint position);
+/* Either out pointer may be NULL; returns FALSE if @id is not in the stack. */
+gboolean meme_layer_stack_lookup (MemeLayerStack *stack, MemeLayerId id,
+                                  LayerGeometry **geometry, LayerContent **content);
+/* Position of @id, or -1 if it is not in the stack. */
+int meme_layer_stack_find (MemeLayerStack *stack, MemeLayerId id);
+
+/* Stores a copy of @layer at @position (-1 appends), taking over the text
+ * and pixbuf references @layer holds, and returns its id. A layer without
+ * an id gets a fresh one; a layer coming back from the undo history keeps
+ * its own. */
+MemeLayerId meme_layer_stack_insert (MemeLayerStack *stack, int position, const ImageLayer *layer);
+/* Removes @id, moving its record (and references) into @out. */
+gboolean meme_layer_stack_take (MemeLayerStack *stack, MemeLayerId id, ImageLayer *out);
+/* Changes @id's place in the z-order; @position is clamped to the stack. */
+void meme_layer_stack_move (MemeLayerStack *stack, MemeLayerId id, guint position);
@@ -0,0 +1,118 @@
+#include "meme-loader.h"
+
+#define RESOURCE_PREFIX "resource://"
+#define LOAD_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+  char *path;
+  int max_size;
+} LoadData;
+
+static void load_data_free (gpointer data) {
+  LoadData *load = (LoadData *)data;
+  g_free (load->path);
+  g_free (load);
+}
+
+static GInputStream * open_stream (const char *path, GCancellable *cancellable, GError **error) {
+  GFile *file;
+  GInputStream *stream;
+
+  if (g_str_has_prefix (path, RESOURCE_PREFIX))
+    return g_resources_open_stream (path + sizeof (RESOURCE_PREFIX) - 1, G_RESOURCE_LOOKUP_FLAGS_NONE, error);
+  file = g_file_new_for_path (path);
+  stream = G_INPUT_STREAM (g_file_read (file, cancellable, error));
+  g_object_unref (file);
+  return stream;
+}
+
+typedef struct {
+  int max_size;
+  int width;
+  int height;
+} SizeRequest;
+
+static void on_size_prepared (GdkPixbufLoader *loader, int width, int height, gpointer data) {
+  SizeRequest *request = (SizeRequest *)data;
+  double scale;
+
+  request->width = width;
+  request->height = height;
+  if (request->max_size <= 0 || MAX (width, height) <= request->max_size) return;
+  scale = (double)request->max_size / MAX (width, height);
+  gdk_pixbuf_loader_set_size (loader, MAX (1, (int)(width * scale + 0.5)), MAX (1, (int)(height * scale + 0.5)));
+}
+
+GdkPixbuf * meme_pixbuf_load (const char *path, int max_size, GCancellable *cancellable, GError **error) {
+  GdkPixbuf *pixbuf = NULL;
+  GInputStream *stream = open_stream (path, cancellable, error);
+  GdkPixbufLoader *loader;
+  SizeRequest request = { max_size, 0, 0 };
+  guchar *buffer;
+  gssize n;
+  gboolean ok = TRUE;
+
+  if (!stream) return NULL;
+  loader = gdk_pixbuf_loader_new ();
+  g_signal_connect (loader, "size-prepared", G_CALLBACK (on_size_prepared), &request);
+  buffer = g_malloc (LOAD_CHUNK_SIZE);
+  while (ok && (n = g_input_stream_read (stream, buffer, LOAD_CHUNK_SIZE, cancellable, error)) != 0)
+    ok = n > 0 && gdk_pixbuf_loader_write (loader, buffer, n, error);
+  g_free (buffer);
+  /* The loader must be closed either way; only report its error if
+   * nothing went wrong before. */
+  if (!gdk_pixbuf_loader_close (loader, ok ? error : NULL)) ok = FALSE;
+  if (ok && !gdk_pixbuf_loader_get_pixbuf (loader)) {
+    g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s holds no image", path);
+    ok = FALSE;
+  }
+
+  if (ok) {
+    pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+    g_object_set_data (G_OBJECT (pixbuf), "meme-source-width", GINT_TO_POINTER (request.width));
+    g_object_set_data (G_OBJECT (pixbuf), "meme-source-height", GINT_TO_POINTER (request.height));
+  }
+  g_object_unref (loader);
+  g_object_unref (stream);
+  return pixbuf;
+}
+
+void meme_pixbuf_get_source_size (GdkPixbuf *pixbuf, int *width, int *height) {
+  *width = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (pixbuf), "meme-source-width"));
+  *height = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (pixbuf), "meme-source-height"));
+  if (*width <= 0 || *height <= 0) {
+    *width = gdk_pixbuf_get_width (pixbuf);
+    *height = gdk_pixbuf_get_height (pixbuf);
+  }
+}
+
+static void load_thread (GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable) {
+  LoadData *load = (LoadData *)task_data;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+
+  if (g_task_return_error_if_cancelled (task)) return;
+  pixbuf = meme_pixbuf_load (load->path, load->max_size, cancellable, &error);
+  if (pixbuf) g_task_return_pointer (task, pixbuf, g_object_unref);
+  else g_task_return_error (task, error);
+}
+
+void meme_pixbuf_load_async (const char *path, int max_size, GCancellable *cancellable,
+                             GAsyncReadyCallback callback, gpointer user_data) {
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+  LoadData *load = g_new0 (LoadData, 1);
+
+  load->path = g_strdup (path);
+  load->max_size = max_size;
+  g_task_set_source_tag (task, meme_pixbuf_load_async);
+  g_task_set_task_data (task, load, load_data_free);
+  g_task_run_in_thread (task, load_thread);
+  g_object_unref (task);
+}
+
+/* The task checks @cancellable again here, so a load superseded after it
+ * finished still reports G_IO_ERROR_CANCELLED. */
+GdkPixbuf * meme_pixbuf_load_finish (GAsyncResult *result, GError **error) {
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "meme-core.h"
+
+/* Image decoding off the main thread.
+ *
+ * @path is a file path or a resource:// URI. The data is streamed through
+ * gdk-pixbuf with @cancellable checked between chunks, so cancelling a
+ * superseded load stops the decode itself rather than just dropping its
+ * result. With @max_size > 0 an image larger than a square of that many
+ * pixels is decoded to fit in it (smaller ones are left alone), which
+ * formats like JPEG do at a fraction of the cost of a full decode; that is
+ * how placeholders and editing proxies are made. */
+
+#define MEME_LOADER_PLACEHOLDER_SIZE 256
+/* Templates are edited on a copy no larger than this, whatever their own
+ * size; export decodes the original. */
+#define MEME_LOADER_PROXY_SIZE 4096
+
+/* Blocking version, for code that is already on a worker thread. */
+GdkPixbuf *meme_pixbuf_load (const char *path, int max_size, GCancellable *cancellable, GError **error);
+
+void meme_pixbuf_load_async (const char *path,
+                             int max_size,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data);
+GdkPixbuf *meme_pixbuf_load_finish (GAsyncResult *result, GError **error);
+
+/* The size of the image @pixbuf was decoded from, before any scaling. */
+void meme_pixbuf_get_source_size (GdkPixbuf *pixbuf, int *width, int *height);
@@ -0,0 +1,150 @@
+#include "meme-raster.h"
+#include <math.h>
+
+typedef struct {
+  cairo_surface_t *levels[MEME_RASTER_MAX_LEVELS];
+  int n_levels;
+} Raster;
+
+/* Batch workers share pixbufs. The lock only covers looking levels up and
+ * installing them; converting and halving run outside it, so two workers
+ * may build the same level and the first one to install it wins. Installed
+ * levels are never written again and are handed out as references. */
+static GMutex raster_lock;
+
+static void raster_free (gpointer data) {
+  Raster *raster = (Raster *)data;
+  int i;
+  for (i = 0; i < raster->n_levels; i++) cairo_surface_destroy (raster->levels[i]);
+  g_free (raster);
+}
+
+static cairo_surface_t * surface_from_pixbuf (GdkPixbuf *pixbuf) {
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                         gdk_pixbuf_get_width (pixbuf),
+                                                         gdk_pixbuf_get_height (pixbuf));
+  cairo_t *cr = cairo_create (surface);
+  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+  return surface;
+}
+
+/* 2x2 box filter. Premultiplied channels average correctly as they are;
+ * an odd last row or column is paired with itself. @src is an installed
+ * level, already flushed, and is only read. */
+static cairo_surface_t * surface_halve (cairo_surface_t *src) {
+  int sw = cairo_image_surface_get_width (src), sh = cairo_image_surface_get_height (src);
+  int dw = MAX (1, (sw + 1) / 2), dh = MAX (1, (sh + 1) / 2);
+  cairo_surface_t *dst = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, dw, dh);
+  int ss = cairo_image_surface_get_stride (src), ds = cairo_image_surface_get_stride (dst);
+  const guchar *sp = cairo_image_surface_get_data (src);
+  guchar *dp = cairo_image_surface_get_data (dst);
+  int x, y, c;
+
+  for (y = 0; y < dh; y++) {
+    const guchar *r0 = sp + (gsize)MIN (2 * y, sh - 1) * ss;
+    const guchar *r1 = sp + (gsize)MIN (2 * y + 1, sh - 1) * ss;
+    guchar *out = dp + (gsize)y * ds;
+    for (x = 0; x < dw; x++) {
+      int x0 = MIN (2 * x, sw - 1) * 4, x1 = MIN (2 * x + 1, sw - 1) * 4;
+      for (c = 0; c < 4; c++)
+        out[x * 4 + c] = (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) >> 2;
+    }
+  }
+  cairo_surface_mark_dirty (dst);
+  return dst;
+}
+
+/* The pixbuf's chain, created with its full-size level on first use. */
+static Raster * raster_get (GdkPixbuf *pixbuf) {
+  static GQuark quark;
+  Raster *raster, *mine;
+
+  g_mutex_lock (&raster_lock);
+  if (G_UNLIKELY (!quark)) quark = g_quark_from_static_string ("meme-raster");
+  raster = g_object_get_qdata (G_OBJECT (pixbuf), quark);
+  g_mutex_unlock (&raster_lock);
+  if (raster) return raster;
+
+  mine = g_new0 (Raster, 1);
+  mine->levels[0] = surface_from_pixbuf (pixbuf);
+  mine->n_levels = 1;
+
+  g_mutex_lock (&raster_lock);
+  raster = g_object_get_qdata (G_OBJECT (pixbuf), quark);
+  if (!raster) {
+    raster = mine;
+    g_object_set_qdata_full (G_OBJECT (pixbuf), quark, raster, raster_free);
+    mine = NULL;
+  }
+  g_mutex_unlock (&raster_lock);
+  if (mine) raster_free (mine);
+  return raster;
+}
+
+/* Returns a new reference to the smallest level at least @scale times the
+ * pixbuf's size, building whatever is missing on the way down. */
+static cairo_surface_t * raster_get_level (GdkPixbuf *pixbuf, double scale) {
+  Raster *raster = raster_get (pixbuf);
+  cairo_surface_t *level, *half;
+  int w = gdk_pixbuf_get_width (pixbuf), h = gdk_pixbuf_get_height (pixbuf);
+  int i = 0, n;
+
+  while (i + 1 < MEME_RASTER_MAX_LEVELS && MAX (w, h) >> (i + 1) > 0 &&
+         ldexp (1.0, -(i + 1)) >= scale)
+    i++;
+
+  for (;;) {
+    g_mutex_lock (&raster_lock);
+    n = raster->n_levels;
+    level = cairo_surface_reference (raster->levels[MIN (i, n - 1)]);
+    g_mutex_unlock (&raster_lock);
+    if (i < n) return level;
+
+    half = surface_halve (level);
+    cairo_surface_destroy (level);
+    g_mutex_lock (&raster_lock);
+    if (raster->n_levels == n) {
+      raster->levels[raster->n_levels++] = half;
+      half = NULL;
+    }
+    g_mutex_unlock (&raster_lock);
+    if (half) cairo_surface_destroy (half);
+  }
+}
+
+void meme_raster_set_source_matrix (cairo_t *cr, GdkPixbuf *pixbuf, const cairo_matrix_t *matrix) {
+  cairo_surface_t *level;
+  cairo_pattern_t *pattern;
+  cairo_matrix_t ctm, inverse, m;
+  double scale;
+
+  /* Output pixels per pixbuf pixel along the more magnified axis. */
+  cairo_get_matrix (cr, &ctm);
+  inverse = *matrix;
+  if (cairo_matrix_invert (&inverse) != CAIRO_STATUS_SUCCESS) return;
+  cairo_matrix_multiply (&m, &inverse, &ctm);
+  scale = MAX (hypot (m.xx, m.yx), hypot (m.xy, m.yy));
+
+  level = raster_get_level (pixbuf, scale);
+  pattern = cairo_pattern_create_for_surface (level);
+  cairo_matrix_init_scale (&m,
+                           (double)cairo_image_surface_get_width (level) / gdk_pixbuf_get_width (pixbuf),
+                           (double)cairo_image_surface_get_height (level) / gdk_pixbuf_get_height (pixbuf));
+  cairo_matrix_multiply (&m, matrix, &m);
+  cairo_pattern_set_matrix (pattern, &m);
+  /* The level is never more than 2x too large, so bilinear is enough. */
+  cairo_pattern_set_filter (pattern, CAIRO_FILTER_BILINEAR);
+  cairo_set_source (cr, pattern);
+  cairo_pattern_destroy (pattern);
+  cairo_surface_destroy (level);
+}
+
+void meme_raster_set_source (cairo_t *cr, GdkPixbuf *pixbuf, double x, double y) {
+  cairo_matrix_t m;
+  cairo_matrix_init_translate (&m, -x, -y);
+  meme_raster_set_source_matrix (cr, pixbuf, &m);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "meme-core.h"
+
+/* Pixbufs converted for cairo once, not on every paint.
+ *
+ * The first time a pixbuf is drawn its premultiplied ARGB32 copy is cached
+ * on the pixbuf itself (as object data, so it goes away with the pixbuf),
+ * along with a mip chain of 2x box-filtered reductions built on demand.
+ * Drawing samples the smallest level that is still at least as large as
+ * the output, so a 4000px photo shown as a small sticker is resampled from
+ * a level of about its screen size rather than filtered down from the
+ * original every frame. */
+
+#define MEME_RASTER_MAX_LEVELS 12
+
+/* Drop-in for gdk_cairo_set_source_pixbuf (); picks the level from @cr's
+ * current transformation. Safe to call from several threads. */
+void meme_raster_set_source (cairo_t *cr, GdkPixbuf *pixbuf, double x, double y);
+/* Like meme_raster_set_source (), with @matrix taking user space to pixbuf
+ * pixels, for rotated or mirrored drawing. */
+void meme_raster_set_source_matrix (cairo_t *cr, GdkPixbuf *pixbuf, const cairo_matrix_t *matrix);
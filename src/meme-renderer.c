@@ -1,21 +1,22 @@
 #include "meme-renderer.h"
+#include "meme-filters.h"
+#include "meme-tiles.h"
+#include "meme-text.h"
+#include "meme-raster.h"
 #include <cairo.h>
 #include <math.h>
 
-void meme_get_image_coordinates (GtkWidget *widget, GdkPixbuf *img, double wx, double wy, double *ix, double *iy) {
-  double ww, wh, iw, ih, scale, draw_w, draw_h, off_x, off_y;
+void meme_get_image_coordinates (GtkWidget *widget, double iw, double ih, double wx, double wy, double *ix, double *iy) {
+  double ww, wh, scale, draw_w, draw_h, off_x, off_y;
   double w_ratio, h_ratio;
 
-  if (!img) { *ix = 0; *iy = 0; return; }
+  if (iw <= 0 || ih <= 0) { *ix = 0; *iy = 0; return; }
 
   ww = gtk_widget_get_width (widget);
   wh = gtk_widget_get_height (widget);
 
   if (ww <= 0 || wh <= 0) { *ix = 0; *iy = 0; return; }
 
-  iw = gdk_pixbuf_get_width (img);
-  ih = gdk_pixbuf_get_height (img);
-
   w_ratio = ww / iw;
   h_ratio = wh / ih;
   scale = (w_ratio < h_ratio) ? w_ratio : h_ratio;
@@ -48,157 +49,253 @@ meme_get_crop_handle_at_position (double x, double y, double cx, double cy, doub
     return HANDLE_NONE;
 }
 
-GdkPixbuf * meme_apply_saturation_contrast (GdkPixbuf *src, double sat, double contrast) {
-  GdkPixbuf *copy;
-  int w, h, stride, n_channels, x, y;
-  guchar *pixels, *row_ptr, *p;
-  double r, g, b, gray, one_minus_sat = 1.0 - sat;
-
-  if (!src) return NULL;
-  copy = gdk_pixbuf_copy (src);
-  w = gdk_pixbuf_get_width (copy);
-  h = gdk_pixbuf_get_height (copy);
-  stride = gdk_pixbuf_get_rowstride (copy);
-  n_channels = gdk_pixbuf_get_n_channels (copy);
-  pixels = gdk_pixbuf_get_pixels (copy);
-
-  for (y = 0; y < h; y++) {
-    row_ptr = pixels + (y * stride);
-    for (x = 0; x < w; x++) {
-      p = row_ptr + (x * n_channels);
-      r = (double)p[0]; g = (double)p[1]; b = (double)p[2];
-
-      gray = 0.299 * r + 0.587 * g + 0.114 * b;
-      r = gray * one_minus_sat + r * sat;
-      g = gray * one_minus_sat + g * sat;
-      b = gray * one_minus_sat + b * sat;
-
-      r = (r - 128.0) * contrast + 128.0;
-      g = (g - 128.0) * contrast + 128.0;
-      b = (b - 128.0) * contrast + 128.0;
-
-      p[0] = CLAMP_U8((int)r); p[1] = CLAMP_U8((int)g); p[2] = CLAMP_U8((int)b);
-    }
+typedef struct {
+  MemePixelLayout layout;
+  guchar *pixels;     /* the whole buffer, for bands to reach past their end */
+  int height;
+  int x0;
+  int y0;
+  double scale_x;
+  double scale_y;
+  gboolean cinematic;
+  gboolean deep_fry;
+  guint32 seed;
+} FilterParams;
+
+/* A scaled cell grid does not line up with the band rows, so each band
+ * takes the rows of the cells that start inside it, running past its end
+ * if a cell does. No two bands touch the same cell. */
+static void post_process_band (guchar *band, int w, int h, int stride, int y0, gpointer data) {
+  FilterParams *f = (FilterParams *)data;
+  int first = y0, end = y0 + h;
+
+  if (f->deep_fry) {
+    int cell = meme_filter_fry_cell_at (f->y0 + y0, f->scale_y);
+    if (y0 > 0 && meme_filter_fry_cell_start (cell, f->scale_y) < f->y0 + y0) cell++;
+    first = MAX (y0, meme_filter_fry_cell_start (cell, f->scale_y) - f->y0);
+    cell = meme_filter_fry_cell_at (f->y0 + end - 1, f->scale_y);
+    end = MIN (f->height, MAX (end, meme_filter_fry_cell_start (cell + 1, f->scale_y) - f->y0));
+    if (first >= end) return;
   }
-  return copy;
+  meme_filter_post_process (f->pixels + (gsize)first * stride, w, end - first, stride, f->layout,
+                            f->x0, f->y0 + first, f->scale_x, f->scale_y, f->cinematic, f->deep_fry, f->seed);
 }
 
-GdkPixbuf * meme_apply_deep_fry (GdkPixbuf *src) {
-  GdkPixbuf *fried = gdk_pixbuf_copy (src);
-  int w = gdk_pixbuf_get_width (fried);
-  int h = gdk_pixbuf_get_height (fried);
-  int nc = gdk_pixbuf_get_n_channels (fried);
-  int rs = gdk_pixbuf_get_rowstride (fried);
-  GdkPixbuf *shrunk, *final;
-  guchar *pixels, *row, *p;
-  double contrast = 2.0;
-  int noise_level = 30;
-  int x, y, i, noise, val;
-  double c_val;
-
-  pixels = gdk_pixbuf_get_pixels (fried);
-
-  for (y = 0; y < h; y++) {
-    row = pixels + y * rs;
-    for (x = 0; x < w; x++) {
-      p = row + x * nc;
-      for (i = 0; i < 3; i++) {
-        noise = (rand() % (noise_level * 2 + 1)) - noise_level;
-        val = p[i] + noise;
-        c_val = ((double)val - 128.0) * contrast + 128.0;
-        p[i] = CLAMP_U8 ((int)c_val);
-      }
-    }
-  }
+/* Returns FALSE if @cancellable fired, leaving the buffer half filtered. */
+static gboolean post_process_buffer (guchar *pixels, int x0, int y0, int w, int h, int stride, MemePixelLayout layout,
+                                     double scale_x, double scale_y, gboolean cinematic, gboolean deep_fry, guint32 seed,
+                                     GCancellable *cancellable) {
+  FilterParams f = { layout, pixels, h, x0, y0, scale_x, scale_y, cinematic, deep_fry, seed };
+  return meme_tiles_run (pixels, w, h, stride, MEME_FILTER_FRY_BLOCK, post_process_band, &f, cancellable);
+}
 
-  shrunk = gdk_pixbuf_scale_simple (fried, MAX (w * 0.25, 1), MAX (h * 0.25, 1), GDK_INTERP_NEAREST);
-  final = gdk_pixbuf_scale_simple (shrunk, w, h, GDK_INTERP_NEAREST);
-  g_object_unref (fried);
-  g_object_unref (shrunk);
-  return final;
+void meme_render_align_to_fry_cells (cairo_rectangle_int_t *rect, double scale_x, double scale_y) {
+  int x1 = meme_filter_fry_cell_start (meme_filter_fry_cell_at (rect->x + rect->width - 1, scale_x) + 1, scale_x);
+  int y1 = meme_filter_fry_cell_start (meme_filter_fry_cell_at (rect->y + rect->height - 1, scale_y) + 1, scale_y);
+
+  if (rect->width <= 0 || rect->height <= 0) return;
+  rect->x = meme_filter_fry_cell_start (meme_filter_fry_cell_at (rect->x, scale_x), scale_x);
+  rect->y = meme_filter_fry_cell_start (meme_filter_fry_cell_at (rect->y, scale_y), scale_y);
+  rect->width = x1 - rect->x;
+  rect->height = y1 - rect->y;
 }
 
-GdkPixbuf * meme_render_composite (GdkPixbuf *bg, GList *layers, gboolean cinematic, gboolean deep_fry) {
-  if (!bg) return NULL;
-  int w = gdk_pixbuf_get_width (bg);
-  int h = gdk_pixbuf_get_height (bg);
+static double layer_wrap_width (const LayerContent *content) {
+  return content->box_width > 0 ? content->box_width - MEME_TEXT_PADDING : 0;
+}
 
-  cairo_surface_t *surf = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, w, h);
-  cairo_t *cr = cairo_create (surf);
+/* Goes through the shared shape cache, so any thread can lay out its own
+ * layers and the shape is ready when the layer is painted. */
+void meme_layer_layout (LayerGeometry *geometry, LayerContent *content) {
+  MemeTextShape *shape;
+  double w, h;
+
+  if (content->type != LAYER_TYPE_TEXT || !content->text) return;
+  if (content->auto_fit && content->box_width > 0 && content->box_height > 0)
+    content->font_size = meme_text_fit_size (content->text, content->box_width, content->box_height);
+
+  shape = meme_text_shape_lookup (content->text, content->font_size, layer_wrap_width (content));
+  meme_text_shape_get_size (shape, &w, &h);
+  meme_text_shape_unref (shape);
+
+  /* A text box keeps its size unless the text overflows it. */
+  geometry->width = MAX (w + MEME_TEXT_PADDING, content->box_width);
+  geometry->height = MAX (h + MEME_TEXT_PADDING, content->box_height);
+  /* Half the outline stroke sticks out of the measured extents. */
+  geometry->outline = content->font_size * 0.04;
+}
 
-  gdk_cairo_set_source_pixbuf (cr, bg, 0.0, 0.0);
-  cairo_paint (cr);
+void meme_layer_get_bounds (const LayerGeometry *layer, double w, double h, cairo_rectangle_int_t *rect) {
+  double hw = layer->width * layer->scale / 2.0;
+  double hh = layer->height * layer->scale / 2.0;
+  double c = fabs (cos (layer->rotation)), s = fabs (sin (layer->rotation));
+  double ex = c * hw + s * hh, ey = s * hw + c * hh;
+  double pad = 2.0 + layer->outline * layer->scale;
+  double cx = layer->x * w, cy = layer->y * h;
+
+  rect->x = (int)floor (cx - ex - pad);
+  rect->y = (int)floor (cy - ey - pad);
+  rect->width = (int)ceil (cx + ex + pad) - rect->x;
+  rect->height = (int)ceil (cy + ey + pad) - rect->y;
+}
 
-  GList *l;
-  for (l = layers; l != NULL; l = l->next) {
-    ImageLayer *layer = (ImageLayer *)l->data;
-    double draw_x = layer->x * w;
-    double draw_y = layer->y * h;
-
-    cairo_save (cr);
-    cairo_translate (cr, draw_x, draw_y);
-    cairo_rotate (cr, layer->rotation);
-    cairo_scale (cr, layer->scale, layer->scale);
-
-    if (layer->blend_mode == BLEND_MULTIPLY) cairo_set_operator(cr, CAIRO_OPERATOR_MULTIPLY);
-    else if (layer->blend_mode == BLEND_SCREEN) cairo_set_operator(cr, CAIRO_OPERATOR_SCREEN);
-    else if (layer->blend_mode == BLEND_OVERLAY) cairo_set_operator(cr, CAIRO_OPERATOR_OVERLAY);
-    else cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-
-    if (layer->type == LAYER_TYPE_IMAGE && layer->pixbuf) {
-       gdk_cairo_set_source_pixbuf (cr, layer->pixbuf, -layer->width/2.0, -layer->height/2.0);
-       if (layer->opacity < 1.0) cairo_paint_with_alpha (cr, layer->opacity);
-       else cairo_paint (cr);
-    }
-    else if (layer->type == LAYER_TYPE_TEXT && layer->text) {
-       cairo_text_extents_t ext;
-       cairo_select_font_face (cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-       cairo_set_font_size (cr, layer->font_size);
-       cairo_text_extents (cr, layer->text, &ext);
+void meme_layer_to_local (const LayerGeometry *layer, int w, int h, double x, double y, double *lx, double *ly) {
+  double dx = x - layer->x * w, dy = y - layer->y * h;
+  double c = cos (layer->rotation), s = sin (layer->rotation);
+  *lx = c * dx + s * dy;
+  *ly = -s * dx + c * dy;
+}
 
-       layer->width = ext.width + 10;
-       layer->height = ext.height + 10;
+void meme_render_layer (cairo_t *cr, const LayerGeometry *layer, const LayerContent *content, double w, double h) {
+  double draw_x = layer->x * w;
+  double draw_y = layer->y * h;
 
-       cairo_move_to (cr, -(ext.width/2.0 + ext.x_bearing), -(ext.height/2.0 + ext.y_bearing));
-       cairo_text_path (cr, layer->text);
+  cairo_save (cr);
+  cairo_translate (cr, draw_x, draw_y);
+  cairo_rotate (cr, layer->rotation);
+  cairo_scale (cr, layer->scale, layer->scale);
 
-       cairo_set_source_rgba (cr, 0, 0, 0, layer->opacity);
-       cairo_set_line_width (cr, layer->font_size * 0.08);
-       cairo_stroke_preserve (cr);
+  if (content->blend_mode == BLEND_MULTIPLY) cairo_set_operator(cr, CAIRO_OPERATOR_MULTIPLY);
+  else if (content->blend_mode == BLEND_SCREEN) cairo_set_operator(cr, CAIRO_OPERATOR_SCREEN);
+  else if (content->blend_mode == BLEND_OVERLAY) cairo_set_operator(cr, CAIRO_OPERATOR_OVERLAY);
+  else cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
-       cairo_set_source_rgba (cr, 1, 1, 1, layer->opacity);
-       cairo_fill (cr);
-    }
-    cairo_restore (cr);
+  if (content->type == LAYER_TYPE_IMAGE && content->pixbuf) {
+     meme_raster_set_source (cr, content->pixbuf, -layer->width/2.0, -layer->height/2.0);
+     if (content->opacity < 1.0) cairo_paint_with_alpha (cr, content->opacity);
+     else cairo_paint (cr);
   }
+  else if (content->type == LAYER_TYPE_TEXT && content->text) {
+     MemeTextShape *shape = meme_text_shape_lookup (content->text, content->font_size, layer_wrap_width (content));
+     cairo_new_path (cr);
+     meme_text_shape_append_path (shape, cr);
+     meme_text_shape_unref (shape);
+
+     cairo_set_source_rgba (cr, 0, 0, 0, content->opacity);
+     cairo_set_line_width (cr, content->font_size * 0.08);
+     cairo_stroke_preserve (cr);
+
+     cairo_set_source_rgba (cr, 1, 1, 1, content->opacity);
+     cairo_fill (cr);
+  }
+  cairo_restore (cr);
+}
 
-  cairo_surface_flush (surf);
-  cairo_destroy (cr);
+void meme_render_post_process (cairo_surface_t *surface, const cairo_rectangle_int_t *area, double scale_x, double scale_y,
+                               gboolean cinematic, gboolean deep_fry, guint32 seed) {
+  cairo_rectangle_int_t r = { 0, 0, cairo_image_surface_get_width (surface), cairo_image_surface_get_height (surface) };
+  int stride = cairo_image_surface_get_stride (surface);
+
+  if (!cinematic && !deep_fry) return;
+  if (area) r = *area;
+  cairo_surface_flush (surface);
+  post_process_buffer (cairo_image_surface_get_data (surface) + (gsize)r.y * stride + r.x * 4,
+                       r.x, r.y, r.width, r.height, stride,
+                       MEME_PIXELS_CAIRO, scale_x, scale_y, cinematic, deep_fry, seed, NULL);
+  cairo_surface_mark_dirty (surface);
+}
 
-  GdkPixbuf *comp = gdk_pixbuf_get_from_surface (surf, 0, 0, w, h);
-  cairo_surface_destroy (surf);
+static gboolean rect_intersect (const cairo_rectangle_int_t *a, const cairo_rectangle_int_t *b, cairo_rectangle_int_t *out) {
+  int x0 = MAX (a->x, b->x), y0 = MAX (a->y, b->y);
+  int x1 = MIN (a->x + a->width, b->x + b->width), y1 = MIN (a->y + a->height, b->y + b->height);
+  *out = (cairo_rectangle_int_t) { x0, y0, MAX (0, x1 - x0), MAX (0, y1 - y0) };
+  return x1 > x0 && y1 > y0;
+}
 
-  if (cinematic) {
-      GdkPixbuf *tmp = meme_apply_saturation_contrast(comp, 1.15, 1.05);
-      if (tmp) { g_object_unref(comp); comp = tmp; }
+cairo_surface_t * meme_render_composite (GdkPixbuf *bg, const MemeGeometry *geometry, MemeLayerStack *layers,
+                                         const cairo_rectangle_int_t *roi,
+                                         gboolean cinematic, gboolean deep_fry, guint32 seed,
+                                         GCancellable *cancellable) {
+  if (!bg) return NULL;
+  MemeGeometry identity;
+  if (!geometry) {
+    meme_geometry_init (&identity, gdk_pixbuf_get_width (bg), gdk_pixbuf_get_height (bg));
+    geometry = &identity;
   }
+  double layer_scale = meme_geometry_get_pixbuf_scale (geometry, bg);
+  int w, h;
+  meme_geometry_get_pixbuf_size (geometry, bg, &w, &h);
+  cairo_rectangle_int_t image = { 0, 0, w, h }, area = image, work, bounds;
+
+  if (roi && !rect_intersect (roi, &image, &area)) return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 0, 0);
+  /* Deep fry samples whole pixelation cells, so the work area is widened to
+   * the cell grid (and clipped to the image, as a full render is). Cells
+   * are laid out in document pixels, like the layers, so an export from
+   * the original behind a proxy fries like the preview does. */
+  work = area;
   if (deep_fry) {
-      GdkPixbuf *tmp = meme_apply_deep_fry(comp);
-      if (tmp) { g_object_unref(comp); comp = tmp; }
+    meme_render_align_to_fry_cells (&work, layer_scale, layer_scale);
+    rect_intersect (&work, &image, &work);
   }
-  return comp;
-}
 
-GdkTexture * meme_render_editor_overlay (GdkPixbuf *composite, GList *layers, ImageLayer *selected, gboolean crop_active, double cx, double cy, double cw, double ch) {
-  if (!composite) return NULL;
-  int w = gdk_pixbuf_get_width (composite);
-  int h = gdk_pixbuf_get_height (composite);
-
-  cairo_surface_t *surf = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, w, h);
+  cairo_surface_t *surf = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, work.width, work.height);
+  /* A template too large for memory. */
+  if (cairo_surface_status (surf) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy (surf);
+    return NULL;
+  }
   cairo_t *cr = cairo_create (surf);
+  /* An integer offset, so the template samples exactly as in a full render. */
+  cairo_translate (cr, -work.x, -work.y);
 
-  gdk_cairo_set_source_pixbuf(cr, composite, 0, 0);
-  cairo_paint(cr);
+  /* Layers live in the document's pixels, which may be a proxy's; their
+   * positions are fractions of the image, so only their sizes change. */
+  double lw = meme_geometry_get_width (geometry), lh = meme_geometry_get_height (geometry);
+  cairo_scale (cr, layer_scale, layer_scale);
+
+  meme_geometry_set_source (cr, geometry, bg);
+  cairo_paint (cr);
+  guint i, n = layers ? meme_layer_stack_get_n_layers (layers) : 0;
+  for (i = 0; i < n && !g_cancellable_is_cancelled (cancellable); i++) {
+    /* Culling reads only the packed geometry; content is fetched to paint. */
+    const LayerGeometry *layer = meme_layer_stack_get_geometry (layers, i);
+    meme_layer_get_bounds (layer, lw, lh, &bounds);
+    bounds.width = (int)ceil ((bounds.x + bounds.width) * layer_scale);
+    bounds.height = (int)ceil ((bounds.y + bounds.height) * layer_scale);
+    bounds.x = (int)floor (bounds.x * layer_scale);
+    bounds.y = (int)floor (bounds.y * layer_scale);
+    bounds.width -= bounds.x;
+    bounds.height -= bounds.y;
+    if (rect_intersect (&bounds, &work, &bounds))
+      meme_render_layer (cr, layer, meme_layer_stack_get_content (layers, i), lw, lh);
+  }
+
+  cairo_destroy (cr);
+
+  /* Filter the ARGB32 buffer we already own; no intermediate pixbufs. The
+   * filters are keyed by image position, hence the work area's origin. */
+  if (cinematic || deep_fry) {
+    cairo_surface_flush (surf);
+    post_process_buffer (cairo_image_surface_get_data (surf), work.x, work.y, work.width, work.height,
+                         cairo_image_surface_get_stride (surf), MEME_PIXELS_CAIRO, layer_scale, layer_scale,
+                         cinematic, deep_fry, seed, cancellable);
+    cairo_surface_mark_dirty (surf);
+  }
+  /* A cancelled render stopped between layers or bands. */
+  if (g_cancellable_is_cancelled (cancellable)) {
+    cairo_surface_destroy (surf);
+    return NULL;
+  }
+
+  if (work.x != area.x || work.y != area.y || work.width != area.width || work.height != area.height) {
+    cairo_surface_t *cropped = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, area.width, area.height);
+    cr = cairo_create (cropped);
+    cairo_set_source_surface (cr, surf, work.x - area.x, work.y - area.y);
+    cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint (cr);
+    cairo_destroy (cr);
+    cairo_surface_destroy (surf);
+    surf = cropped;
+    if (cairo_surface_status (surf) != CAIRO_STATUS_SUCCESS) {
+      cairo_surface_destroy (surf);
+      return NULL;
+    }
+  }
+  return surf;
+}
+
+void meme_render_editor_overlay (cairo_t *cr, double w, double h, const LayerGeometry *selected, gboolean crop_active, double cx, double cy, double cw, double ch, double px) {
+  cairo_save(cr);
 
   if (crop_active) {
      double abs_x = cx * w;
@@ -214,13 +311,13 @@ GdkTexture * meme_render_editor_overlay (GdkPixbuf *composite, GList *layers, Im
 
      
      cairo_set_source_rgba(cr, 1, 1, 1, 0.9);
-     cairo_set_line_width(cr, 2.0);
+     cairo_set_line_width(cr, 2.0 * px);
      cairo_rectangle(cr, abs_x, abs_y, abs_w, abs_h);
      cairo_stroke(cr);
 
      
      cairo_set_source_rgba(cr, 1, 1, 1, 0.3);
-     cairo_set_line_width(cr, 1.0);
+     cairo_set_line_width(cr, 1.0 * px);
      cairo_move_to(cr, abs_x + abs_w/3.0, abs_y); cairo_line_to(cr, abs_x + abs_w/3.0, abs_y + abs_h);
      cairo_move_to(cr, abs_x + 2*abs_w/3.0, abs_y); cairo_line_to(cr, abs_x + 2*abs_w/3.0, abs_y + abs_h);
      cairo_move_to(cr, abs_x, abs_y + abs_h/3.0); cairo_line_to(cr, abs_x + abs_w, abs_y + abs_h/3.0);
@@ -228,7 +325,7 @@ GdkTexture * meme_render_editor_overlay (GdkPixbuf *composite, GList *layers, Im
      cairo_stroke(cr);
 
      
-     double hr = 5.0;
+     double hr = 5.0 * px;
      cairo_set_source_rgba(cr, 1, 1, 1, 1);
      cairo_arc(cr, abs_x, abs_y, hr, 0, 2*M_PI); cairo_fill(cr);
      cairo_arc(cr, abs_x + abs_w, abs_y, hr, 0, 2*M_PI); cairo_fill(cr);
@@ -249,17 +346,11 @@ GdkTexture * meme_render_editor_overlay (GdkPixbuf *composite, GList *layers, Im
      cairo_translate(cr, sx, sy);
      cairo_rotate(cr, selected->rotation);
      cairo_set_source_rgba(cr, 0.4, 0.2, 0.8, 0.8);
-     cairo_set_line_width(cr, 2.0);
+     cairo_set_line_width(cr, 2.0 * px);
      cairo_rectangle(cr, -bw/2.0, -bh/2.0, bw, bh);
      cairo_stroke(cr);
      cairo_restore(cr);
   }
 
-  cairo_destroy(cr);
-  GdkPixbuf *res = gdk_pixbuf_get_from_surface(surf, 0, 0, w, h);
-  cairo_surface_destroy(surf);
-
-  GdkTexture *tex = gdk_texture_new_for_pixbuf(res);
-  g_object_unref(res);
-  return tex;
+  cairo_restore(cr);
 }
\ No newline at end of file
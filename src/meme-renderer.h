@@ -1,17 +1,55 @@
 #pragma once
-#include "meme-core.h"
+#include "meme-layers.h"
+#include "meme-geometry.h"
 
-void meme_get_image_coordinates (GtkWidget *widget, GdkPixbuf *img, double wx, double wy, double *ix, double *iy);
+void meme_get_image_coordinates (GtkWidget *widget, double iw, double ih, double wx, double wy, double *ix, double *iy);
 ResizeHandle meme_get_crop_handle_at_position (double x, double y, double crop_x, double crop_y, double crop_w, double crop_h);
 
-GdkPixbuf *meme_apply_saturation_contrast (GdkPixbuf *src, double sat, double contrast);
-GdkPixbuf *meme_apply_deep_fry (GdkPixbuf *src);
+/* Filters in place. @scale_x/@scale_y are @surface's size relative to the
+ * document, so a scaled-down preview fries the same cells as a full-size
+ * render. With deep fry on, @area (NULL for all of it) must be aligned
+ * with meme_render_align_to_fry_cells () at the same scale. */
+void meme_render_post_process (cairo_surface_t *surface, const cairo_rectangle_int_t *area,
+                               double scale_x, double scale_y,
+                               gboolean cinematic, gboolean deep_fry, guint32 seed);
+/* Widens @rect to whole deep-fry cells of a surface at that scale. */
+void meme_render_align_to_fry_cells (cairo_rectangle_int_t *rect, double scale_x, double scale_y);
 
+/* Layout pass: sets a text layer's width and height from its text and font
+ * size. Call whenever either changes; painting and hit-testing only read the
+ * cached size. Does nothing for image layers. */
+void meme_layer_layout (LayerGeometry *geometry, LayerContent *content);
+/* Geometry alone, so culling and damage never touch the content. */
+void meme_layer_get_bounds (const LayerGeometry *layer, double w, double h, cairo_rectangle_int_t *rect);
+/* Maps (@x, @y) in template pixels into the layer's unrotated frame, centred
+ * on the layer and still scaled, so its box is +-width*scale/2, +-height*scale/2. */
+void meme_layer_to_local (const LayerGeometry *layer, int w, int h, double x, double y, double *lx, double *ly);
+void meme_render_layer (cairo_t *cr, const LayerGeometry *layer, const LayerContent *content, double w, double h);
 
-GdkPixbuf *meme_render_composite (GdkPixbuf *bg, GList *layers, gboolean cinematic, gboolean deep_fry);
 
-GdkTexture *meme_render_editor_overlay (GdkPixbuf *composite, 
-                                        GList *layers, 
-                                        ImageLayer *selected_layer,
-                                        gboolean crop_active,
-                                        double cx, double cy, double cw, double ch);
\ No newline at end of file
+/* Full-resolution render into a premultiplied ARGB32 surface. @seed keys the
+ * deep-fry noise; the same document and seed give the same pixels.
+ * Convert to a pixbuf only when the pixels leave the app.
+ * The image is @bg seen through @geometry (NULL for @bg as it is), and
+ * @layers are laid out on the geometry's size. A @bg larger than the image
+ * the geometry was made for (the original behind an editing proxy) renders
+ * that many times larger, layers included.
+ * With a region of interest @roi (output pixels, NULL for the whole image)
+ * the surface is just that region, clipped to the image, and holds exactly
+ * the pixels a full render would have there; the layers and filters only
+ * run over it, so a tight crop costs in proportion to its area.
+ * Returns NULL once @cancellable fires, or if the surface cannot be
+ * allocated. */
+cairo_surface_t *meme_render_composite (GdkPixbuf *bg, const MemeGeometry *geometry, MemeLayerStack *layers,
+                                        const cairo_rectangle_int_t *roi,
+                                        gboolean cinematic, gboolean deep_fry, guint32 seed,
+                                        GCancellable *cancellable);
+
+/* Draws the selection box or crop chrome in image coordinates; @px is the
+ * size of one screen pixel in image units so strokes stay crisp at any zoom. */
+void meme_render_editor_overlay (cairo_t *cr,
+                                 double w, double h,
+                                 const LayerGeometry *selected_layer,
+                                 gboolean crop_active,
+                                 double cx, double cy, double cw, double ch,
+                                 double px);
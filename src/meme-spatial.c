@@ -0,0 +1,164 @@
+#include "meme-spatial.h"
+#include <math.h>
+
+typedef struct {
+  MemeLayerId id;
+  double cx, cy;       /* centre, template pixels */
+  double hw, hh;       /* scaled half extents */
+  double rotation;
+  double cos_r, sin_r;
+  int c0, r0, c1, r1;  /* cells covered, inclusive */
+} Entry;
+
+struct _MemeSpatialIndex {
+  GArray *entries;     /* Entry, by stack position */
+  GArray **cells;      /* cols * rows arrays of positions, created on demand */
+  int cols, rows;
+  double cell_w, cell_h;
+  int doc_width, doc_height;
+};
+
+static void entry_from_layer (Entry *e, const LayerGeometry *layer, int w, int h) {
+  e->id = layer->id;
+  e->cx = layer->x * w;
+  e->cy = layer->y * h;
+  e->hw = layer->width * layer->scale / 2.0;
+  e->hh = layer->height * layer->scale / 2.0;
+  e->rotation = layer->rotation;
+  e->cos_r = cos (layer->rotation);
+  e->sin_r = sin (layer->rotation);
+}
+
+static gboolean entry_same_transform (const Entry *a, const Entry *b) {
+  return a->cx == b->cx && a->cy == b->cy && a->hw == b->hw && a->hh == b->hh && a->rotation == b->rotation;
+}
+
+static gboolean entry_contains (const Entry *e, double x, double y) {
+  double dx = x - e->cx, dy = y - e->cy;
+  double lx = e->cos_r * dx + e->sin_r * dy;
+  double ly = -e->sin_r * dx + e->cos_r * dy;
+  return fabs (lx) <= e->hw && fabs (ly) <= e->hh;
+}
+
+/* Points off the document land in the edge cells, which is also where the
+ * parts of layers hanging over the edge are binned. */
+static int cell_col (MemeSpatialIndex *index, double x) {
+  return CLAMP ((int)floor (x / index->cell_w), 0, index->cols - 1);
+}
+
+static int cell_row (MemeSpatialIndex *index, double y) {
+  return CLAMP ((int)floor (y / index->cell_h), 0, index->rows - 1);
+}
+
+static void entry_bin (MemeSpatialIndex *index, Entry *e, guint position) {
+  double ex = fabs (e->cos_r) * e->hw + fabs (e->sin_r) * e->hh;
+  double ey = fabs (e->sin_r) * e->hw + fabs (e->cos_r) * e->hh;
+  int c, r;
+
+  e->c0 = cell_col (index, e->cx - ex);
+  e->c1 = cell_col (index, e->cx + ex);
+  e->r0 = cell_row (index, e->cy - ey);
+  e->r1 = cell_row (index, e->cy + ey);
+  for (r = e->r0; r <= e->r1; r++) {
+    for (c = e->c0; c <= e->c1; c++) {
+      GArray **cell = &index->cells[r * index->cols + c];
+      if (!*cell) *cell = g_array_new (FALSE, FALSE, sizeof (guint));
+      g_array_append_val (*cell, position);
+    }
+  }
+}
+
+static void entry_unbin (MemeSpatialIndex *index, const Entry *e, guint position) {
+  int c, r;
+  guint i;
+
+  for (r = e->r0; r <= e->r1; r++) {
+    for (c = e->c0; c <= e->c1; c++) {
+      GArray *cell = index->cells[r * index->cols + c];
+      for (i = 0; cell && i < cell->len; i++) {
+        if (g_array_index (cell, guint, i) == position) { g_array_remove_index_fast (cell, i); break; }
+      }
+    }
+  }
+}
+
+static void index_clear_cells (MemeSpatialIndex *index) {
+  int i;
+  for (i = 0; i < index->cols * index->rows; i++) {
+    if (index->cells[i]) g_array_unref (index->cells[i]);
+  }
+  g_clear_pointer (&index->cells, g_free);
+  index->cols = index->rows = 0;
+}
+
+static void index_rebuild (MemeSpatialIndex *index, MemeLayerStack *layers, int w, int h) {
+  guint i, n = meme_layer_stack_get_n_layers (layers);
+  double cell = MAX (64.0, ceil (MAX (w, h) / (double)MEME_SPATIAL_GRID_CELLS));
+
+  index_clear_cells (index);
+  index->doc_width = w;
+  index->doc_height = h;
+  index->cell_w = index->cell_h = cell;
+  index->cols = MAX (1, (int)ceil (w / cell));
+  index->rows = MAX (1, (int)ceil (h / cell));
+  index->cells = g_new0 (GArray *, index->cols * index->rows);
+
+  g_array_set_size (index->entries, n);
+  for (i = 0; i < n; i++) {
+    Entry *e = &g_array_index (index->entries, Entry, i);
+    entry_from_layer (e, meme_layer_stack_get_geometry (layers, i), w, h);
+    entry_bin (index, e, i);
+  }
+}
+
+MemeSpatialIndex * meme_spatial_index_new (void) {
+  MemeSpatialIndex *index = g_new0 (MemeSpatialIndex, 1);
+  index->entries = g_array_new (FALSE, TRUE, sizeof (Entry));
+  return index;
+}
+
+void meme_spatial_index_free (MemeSpatialIndex *index) {
+  if (!index) return;
+  index_clear_cells (index);
+  g_array_unref (index->entries);
+  g_free (index);
+}
+
+void meme_spatial_index_sync (MemeSpatialIndex *index, MemeLayerStack *layers, int doc_width, int doc_height) {
+  guint i, n = meme_layer_stack_get_n_layers (layers);
+  gboolean rebuild = !index->cells || index->doc_width != doc_width || index->doc_height != doc_height ||
+                     index->entries->len != n;
+  Entry fresh;
+
+  for (i = 0; !rebuild && i < n; i++) {
+    if (g_array_index (index->entries, Entry, i).id != meme_layer_stack_get_geometry (layers, i)->id) rebuild = TRUE;
+  }
+  if (rebuild) {
+    index_rebuild (index, layers, doc_width, doc_height);
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    Entry *e = &g_array_index (index->entries, Entry, i);
+    entry_from_layer (&fresh, meme_layer_stack_get_geometry (layers, i), doc_width, doc_height);
+    if (entry_same_transform (e, &fresh)) continue;
+    entry_unbin (index, e, i);
+    *e = fresh;
+    entry_bin (index, e, i);
+  }
+}
+
+MemeLayerId meme_spatial_index_pick (MemeSpatialIndex *index, double x, double y) {
+  GArray *cell;
+  guint i, position;
+  int best = -1;
+
+  if (!index->cells) return 0;
+  cell = index->cells[cell_row (index, y) * index->cols + cell_col (index, x)];
+  for (i = 0; cell && i < cell->len; i++) {
+    position = g_array_index (cell, guint, i);
+    if ((int)position > best && entry_contains (&g_array_index (index->entries, Entry, position), x, y))
+      best = position;
+  }
+  return best < 0 ? 0 : g_array_index (index->entries, Entry, best).id;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "meme-layers.h"
+
+/* Hit-testing index over the layers' oriented bounding boxes.
+ *
+ * The document is cut into a uniform grid of at most
+ * MEME_SPATIAL_GRID_CELLS cells per side and every layer is binned into the
+ * cells its rotated box overlaps. A point query only tests the layers of one
+ * cell, against their exact rotated boxes, and returns the topmost.
+ *
+ * sync () diffs the stack against the transforms it saw last time and only
+ * rebins layers that moved, scaled, rotated or were resized; adding,
+ * removing or reordering layers rebuilds the grid. */
+
+#define MEME_SPATIAL_GRID_CELLS 16
+
+typedef struct _MemeSpatialIndex MemeSpatialIndex;
+
+MemeSpatialIndex *meme_spatial_index_new (void);
+void meme_spatial_index_free (MemeSpatialIndex *index);
+
+void meme_spatial_index_sync (MemeSpatialIndex *index, MemeLayerStack *layers, int doc_width, int doc_height);
+/* Topmost layer under (@x, @y) in template pixels, or 0 for none. */
+MemeLayerId meme_spatial_index_pick (MemeSpatialIndex *index, double x, double y);
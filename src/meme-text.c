@@ -0,0 +1,219 @@
+#include "meme-text.h"
+#include <pango/pangocairo.h>
+
+/* Immutable once published, so any thread can replay it without a lock. */
+struct _MemeTextShape {
+  cairo_path_t *path;    /* outline, centred on the origin */
+  double x, y, width, height;
+};
+
+/* Pango objects are not shared between threads; each thread shapes on its
+ * own context, outside text_lock. */
+typedef struct {
+  PangoContext *context;
+  PangoLayout *layout;   /* reused for every shape and probe */
+  cairo_t *scratch;      /* target for building outlines */
+} TextThread;
+
+typedef struct {
+  char *key;
+  MemeTextShape *shape;
+  GList link;            /* in text_lru */
+} CacheEntry;
+
+static GMutex text_lock;        /* guards text_cache and text_lru only */
+static GHashTable *text_cache;  /* key string -> CacheEntry */
+static GQueue text_lru;         /* CacheEntry links, most recently used first */
+
+static void text_thread_free (gpointer data) {
+  TextThread *thread = (TextThread *)data;
+  g_object_unref (thread->layout);
+  g_object_unref (thread->context);
+  cairo_destroy (thread->scratch);
+  g_free (thread);
+}
+
+static GPrivate text_thread = G_PRIVATE_INIT (text_thread_free);
+
+/* Unhinted metrics, so a caption has the same shape at every zoom and in
+ * the export. */
+static TextThread * text_thread_get (void) {
+  TextThread *thread = g_private_get (&text_thread);
+  PangoFontMap *font_map;
+  cairo_font_options_t *options;
+  cairo_surface_t *surface;
+
+  if (thread) return thread;
+  thread = g_new0 (TextThread, 1);
+  font_map = pango_cairo_font_map_new ();
+  thread->context = pango_font_map_create_context (font_map);
+  g_object_unref (font_map);
+  options = cairo_font_options_create ();
+  cairo_font_options_set_hint_metrics (options, CAIRO_HINT_METRICS_OFF);
+  cairo_font_options_set_hint_style (options, CAIRO_HINT_STYLE_NONE);
+  pango_cairo_context_set_font_options (thread->context, options);
+  cairo_font_options_destroy (options);
+  pango_context_set_round_glyph_positions (thread->context, FALSE);
+
+  thread->layout = pango_layout_new (thread->context);
+  pango_layout_set_alignment (thread->layout, PANGO_ALIGN_CENTER);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+  thread->scratch = cairo_create (surface);
+  cairo_surface_destroy (surface);
+
+  g_private_set (&text_thread, thread);
+  return thread;
+}
+
+/* Lays @text out on the thread's layout and returns the box around the ink
+ * and the line boxes; the ink can stick out of the line boxes (and vice
+ * versa for spaces), and the box has to hold both. */
+static PangoLayout * text_layout (TextThread *thread, const char *text, double font_size, double wrap_width,
+                                  double *x, double *y, double *width, double *height) {
+  PangoFontDescription *desc = pango_font_description_from_string (MEME_TEXT_FONT);
+  PangoLayout *layout = thread->layout;
+  PangoRectangle ink, logical;
+  int x0, y0, x1, y1;
+
+  pango_font_description_set_absolute_size (desc, font_size * PANGO_SCALE);
+  pango_layout_set_font_description (layout, desc);
+  pango_font_description_free (desc);
+  pango_layout_set_width (layout, wrap_width > 0 ? (int)(wrap_width * PANGO_SCALE) : -1);
+  pango_layout_set_wrap (layout, PANGO_WRAP_WORD_CHAR);
+  pango_layout_set_text (layout, text, -1);
+
+  pango_layout_get_extents (layout, &ink, &logical);
+  x0 = MIN (ink.x, logical.x);
+  y0 = MIN (ink.y, logical.y);
+  x1 = MAX (ink.x + ink.width, logical.x + logical.width);
+  y1 = MAX (ink.y + ink.height, logical.y + logical.height);
+  *x = (double)x0 / PANGO_SCALE;
+  *y = (double)y0 / PANGO_SCALE;
+  *width = (double)(x1 - x0) / PANGO_SCALE;
+  *height = (double)(y1 - y0) / PANGO_SCALE;
+  return layout;
+}
+
+static void shape_clear (gpointer data) {
+  MemeTextShape *shape = (MemeTextShape *)data;
+  g_clear_pointer (&shape->path, cairo_path_destroy);
+}
+
+MemeTextShape * meme_text_shape_ref (MemeTextShape *shape) {
+  return g_atomic_rc_box_acquire (shape);
+}
+
+void meme_text_shape_unref (MemeTextShape *shape) {
+  if (shape) g_atomic_rc_box_release_full (shape, shape_clear);
+}
+
+static MemeTextShape * shape_new (const char *text, double font_size, double wrap_width) {
+  TextThread *thread = text_thread_get ();
+  MemeTextShape *shape = g_atomic_rc_box_new0 (MemeTextShape);
+  PangoLayout *layout;
+
+  layout = text_layout (thread, text, font_size, wrap_width, &shape->x, &shape->y, &shape->width, &shape->height);
+  cairo_new_path (thread->scratch);
+  cairo_move_to (thread->scratch, -(shape->x + shape->width / 2.0), -(shape->y + shape->height / 2.0));
+  pango_cairo_layout_path (thread->scratch, layout);
+  shape->path = cairo_copy_path (thread->scratch);
+  cairo_new_path (thread->scratch);
+  return shape;
+}
+
+static void cache_entry_free (gpointer data) {
+  CacheEntry *entry = (CacheEntry *)data;
+  g_free (entry->key);
+  meme_text_shape_unref (entry->shape);
+  g_free (entry);
+}
+
+/* Finds @key and marks it most recently used. Called with text_lock held. */
+static MemeTextShape * cache_lookup (const char *key) {
+  CacheEntry *entry;
+
+  if (!text_cache)
+    text_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cache_entry_free);
+  entry = g_hash_table_lookup (text_cache, key);
+  if (!entry) return NULL;
+  g_queue_unlink (&text_lru, &entry->link);
+  g_queue_push_head_link (&text_lru, &entry->link);
+  return entry->shape;
+}
+
+/* Takes over @key and @shape, evicting the least recently used entries past
+ * MEME_TEXT_CACHE_SIZE. Shapes in use elsewhere survive eviction through
+ * their refcount. Called with text_lock held. */
+static void cache_insert (char *key, MemeTextShape *shape) {
+  CacheEntry *entry = g_new0 (CacheEntry, 1);
+
+  entry->key = key;
+  entry->shape = shape;
+  entry->link.data = entry;
+  g_hash_table_insert (text_cache, key, entry);
+  g_queue_push_head_link (&text_lru, &entry->link);
+  while (text_lru.length > MEME_TEXT_CACHE_SIZE) {
+    CacheEntry *old = g_queue_pop_tail_link (&text_lru)->data;
+    g_hash_table_remove (text_cache, old->key);
+  }
+}
+
+MemeTextShape * meme_text_shape_lookup (const char *text, double font_size, double wrap_width) {
+  MemeTextShape *shape, *cached;
+  char *key;
+
+  g_return_val_if_fail (text != NULL, NULL);
+  key = g_strdup_printf ("%g/%g/%s", font_size, MAX (wrap_width, 0.0), text);
+  g_mutex_lock (&text_lock);
+  shape = cache_lookup (key);
+  if (shape) meme_text_shape_ref (shape);
+  g_mutex_unlock (&text_lock);
+  if (shape) { g_free (key); return shape; }
+
+  shape = shape_new (text, font_size, wrap_width);
+
+  /* Another thread may have shaped the same text meanwhile; keep theirs. */
+  g_mutex_lock (&text_lock);
+  cached = cache_lookup (key);
+  if (cached) {
+    meme_text_shape_unref (shape);
+    g_free (key);
+    shape = cached;
+  } else {
+    cache_insert (key, shape);
+  }
+  meme_text_shape_ref (shape);
+  g_mutex_unlock (&text_lock);
+  return shape;
+}
+
+void meme_text_shape_get_size (MemeTextShape *shape, double *width, double *height) {
+  *width = shape->width;
+  *height = shape->height;
+}
+
+void meme_text_shape_append_path (MemeTextShape *shape, cairo_t *cr) {
+  cairo_append_path (cr, shape->path);
+}
+
+/* A probe only needs the metrics; it is measured on the thread's layout and
+ * never built into an outline or put in the cache. */
+static gboolean text_fits (TextThread *thread, const char *text, int size, double box_width, double box_height) {
+  double x, y, width, height;
+
+  text_layout (thread, text, size, box_width - MEME_TEXT_PADDING, &x, &y, &width, &height);
+  return width + MEME_TEXT_PADDING <= box_width && height + MEME_TEXT_PADDING <= box_height;
+}
+
+double meme_text_fit_size (const char *text, double box_width, double box_height) {
+  TextThread *thread = text_thread_get ();
+  int lo = MEME_TEXT_MIN_SIZE, hi = MEME_TEXT_MAX_SIZE;
+
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (text_fits (thread, text, mid, box_width, box_height)) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "meme-core.h"
+
+/* Text shaping for text layers, through Pango.
+ *
+ * Shaping and outlining a caption costs far more than filling it, so each
+ * (text, size, wrap width) is shaped and outlined once and kept in a cache
+ * shared by all threads; dragging a layer only replays its cached outline.
+ * Threads shape on their own Pango context and only lock the cache to look
+ * up and insert. It holds the MEME_TEXT_CACHE_SIZE most recently used
+ * shapes. */
+
+#define MEME_TEXT_FONT       "Sans Bold"
+#define MEME_TEXT_PADDING    10.0
+#define MEME_TEXT_MIN_SIZE   10
+#define MEME_TEXT_MAX_SIZE   300
+#define MEME_TEXT_CACHE_SIZE 256
+
+typedef struct _MemeTextShape MemeTextShape;
+
+/* @wrap_width <= 0 lays the text out on one line per paragraph. */
+MemeTextShape *meme_text_shape_lookup (const char *text, double font_size, double wrap_width);
+MemeTextShape *meme_text_shape_ref (MemeTextShape *shape);
+void meme_text_shape_unref (MemeTextShape *shape);
+
+/* Size of the box around the ink and the line boxes, without padding. */
+void meme_text_shape_get_size (MemeTextShape *shape, double *width, double *height);
+/* Appends the outline, centred on the origin, to @cr's current path. */
+void meme_text_shape_append_path (MemeTextShape *shape, cairo_t *cr);
+
+/* Largest whole font size, between MEME_TEXT_MIN_SIZE and
+ * MEME_TEXT_MAX_SIZE, at which @text wrapped to @box_width fits the box
+ * (padding included). Binary search over metrics only; the probes never
+ * enter the cache. */
+double meme_text_fit_size (const char *text, double box_width, double box_height);
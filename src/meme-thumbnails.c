@@ -0,0 +1,167 @@
+#include "meme-thumbnails.h"
+#include "meme-loader.h"
+#include <glib/gstdio.h>
+
+#define RESOURCE_PREFIX "resource://"
+#define CACHE_MAX_BYTES (64 * 1024 * 1024)
+#define CACHE_MAX_AGE (90 * G_TIME_SPAN_DAY)
+
+static GThreadPool *thumbnail_pool;
+
+/* Files change under us; resources only change with the binary, and their
+ * size stands in for a modification time. */
+static char * thumbnail_key (const char *path, GCancellable *cancellable, GError **error) {
+  gint64 mtime = 0;
+  goffset size = 0;
+  char *data, *key;
+
+  if (g_str_has_prefix (path, RESOURCE_PREFIX)) {
+    gsize res_size;
+    if (!g_resources_get_info (path + sizeof (RESOURCE_PREFIX) - 1, G_RESOURCE_LOOKUP_FLAGS_NONE, &res_size, NULL, error))
+      return NULL;
+    size = res_size;
+  } else {
+    GFile *file = g_file_new_for_path (path);
+    GFileInfo *info = g_file_query_info (file, G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+                                         G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, cancellable, error);
+    g_object_unref (file);
+    if (!info) return NULL;
+    mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+            g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    size = g_file_info_get_size (info);
+    g_object_unref (info);
+  }
+
+  data = g_strdup_printf ("%s\n%" G_GINT64_FORMAT "\n%" G_GOFFSET_FORMAT "\n%d", path, mtime, size, MEME_THUMBNAIL_SIZE);
+  key = g_compute_checksum_for_string (G_CHECKSUM_SHA1, data, -1);
+  g_free (data);
+  return key;
+}
+
+typedef struct {
+  char *path;
+  goffset size;
+  gint64 mtime;
+} CacheEntry;
+
+static void cache_entry_free (gpointer data) {
+  CacheEntry *entry = (CacheEntry *)data;
+  g_free (entry->path);
+  g_free (entry);
+}
+
+static int cache_entry_newer (gconstpointer a, gconstpointer b) {
+  gint64 ta = (*(CacheEntry **)a)->mtime, tb = (*(CacheEntry **)b)->mtime;
+  return (ta < tb) - (ta > tb);
+}
+
+/* Hits refresh a thumbnail's modification time, so it reads as its last
+ * use: entries unused for CACHE_MAX_AGE go, then the least recently used
+ * until the rest fit in CACHE_MAX_BYTES. */
+static void thumbnail_cache_prune (const char *dir) {
+  GFile *file = g_file_new_for_path (dir);
+  GFileEnumerator *children = g_file_enumerate_children (file, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                                         G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+  GPtrArray *entries = g_ptr_array_new_with_free_func (cache_entry_free);
+  gint64 now = g_get_real_time ();
+  goffset total = 0;
+  GFileInfo *info;
+  guint i;
+
+  g_object_unref (file);
+  if (!children) { g_ptr_array_unref (entries); return; }
+  while ((info = g_file_enumerator_next_file (children, NULL, NULL))) {
+    CacheEntry *entry = g_new0 (CacheEntry, 1);
+    entry->path = g_build_filename (dir, g_file_info_get_name (info), NULL);
+    entry->size = g_file_info_get_size (info);
+    entry->mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC;
+    g_ptr_array_add (entries, entry);
+    g_object_unref (info);
+  }
+  g_object_unref (children);
+
+  g_ptr_array_sort (entries, cache_entry_newer);
+  for (i = 0; i < entries->len; i++) {
+    CacheEntry *entry = g_ptr_array_index (entries, i);
+    total += entry->size;
+    if (total > CACHE_MAX_BYTES || now - entry->mtime > CACHE_MAX_AGE) g_unlink (entry->path);
+  }
+  g_ptr_array_unref (entries);
+}
+
+static GdkPixbuf * thumbnail_load (const char *path, GCancellable *cancellable, GError **error) {
+  GdkPixbuf *pixbuf;
+  char *key, *dir, *name, *cache_path;
+  gchar *buffer;
+  gsize length;
+
+  key = thumbnail_key (path, cancellable, error);
+  if (!key) return NULL;
+  dir = g_build_filename (g_get_user_cache_dir (), "memerist", "thumbnails", NULL);
+  name = g_strconcat (key, ".png", NULL);
+  cache_path = g_build_filename (dir, name, NULL);
+  g_free (name);
+  g_free (key);
+
+  pixbuf = gdk_pixbuf_new_from_file (cache_path, NULL);
+  if (pixbuf) {
+    g_utime (cache_path, NULL);
+  } else {
+    static gsize pruned = 0;
+    pixbuf = meme_pixbuf_load (path, MEME_THUMBNAIL_SIZE, cancellable, error);
+    /* The first write of a session makes room for the ones to come. */
+    if (pixbuf && g_once_init_enter (&pruned)) {
+      thumbnail_cache_prune (dir);
+      g_once_init_leave (&pruned, 1);
+    }
+    /* A cache that cannot be written only costs speed. Writing goes through
+     * a temporary file, so readers never see half a thumbnail. */
+    if (pixbuf && g_mkdir_with_parents (dir, 0700) == 0 &&
+        gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &length, "png", NULL, NULL)) {
+      g_file_set_contents (cache_path, buffer, length, NULL);
+      g_free (buffer);
+    }
+  }
+
+  g_free (cache_path);
+  g_free (dir);
+  return pixbuf;
+}
+
+static void thumbnail_thread (gpointer data, gpointer user_data) {
+  GTask *task = G_TASK (data);
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+
+  if (!g_task_return_error_if_cancelled (task)) {
+    pixbuf = thumbnail_load (g_task_get_task_data (task), g_task_get_cancellable (task), &error);
+    if (pixbuf) g_task_return_pointer (task, pixbuf, g_object_unref);
+    else g_task_return_error (task, error);
+  }
+  g_object_unref (task);
+}
+
+static GThreadPool * thumbnail_pool_get (void) {
+  static gsize init = 0;
+  if (g_once_init_enter (&init)) {
+    thumbnail_pool = g_thread_pool_new (thumbnail_thread, NULL, (int)g_get_num_processors (), FALSE, NULL);
+    g_once_init_leave (&init, 1);
+  }
+  return thumbnail_pool;
+}
+
+void meme_thumbnail_load_async (const char *path, GCancellable *cancellable,
+                                GAsyncReadyCallback callback, gpointer user_data) {
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+
+  g_task_set_source_tag (task, meme_thumbnail_load_async);
+  g_task_set_task_data (task, g_strdup (path), g_free);
+  /* The pool owns the reference until the task has returned. */
+  g_thread_pool_push (thumbnail_pool_get (), task, NULL);
+}
+
+GdkPixbuf * meme_thumbnail_load_finish (GAsyncResult *result, GError **error) {
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "meme-core.h"
+
+/* Gallery thumbnails, cached on disk.
+ *
+ * Thumbnails live in $XDG_CACHE_HOME/memerist/thumbnails as PNGs named
+ * after a hash of the template's path, modification time and size, so an
+ * edited or replaced file gets a new thumbnail and the gallery never has
+ * to decode a full-size template again. Before its first write in a
+ * session the cache is trimmed to a size and age cap, least recently used
+ * first. Misses are decoded straight to thumbnail size on a pool of one
+ * thread per core that is kept apart from GTask's, so a large gallery
+ * cannot hold up opening a template. */
+
+#define MEME_THUMBNAIL_SIZE 240
+
+/* @path is a file path or a resource:// URI. */
+void meme_thumbnail_load_async (const char *path,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data);
+GdkPixbuf *meme_thumbnail_load_finish (GAsyncResult *result, GError **error);
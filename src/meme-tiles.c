@@ -0,0 +1,121 @@
+#include "meme-tiles.h"
+
+/* Aim for bands that fit comfortably in a per-core L2 cache. */
+#define BAND_TARGET_BYTES (256 * 1024)
+/* Below this there is nothing to gain from waking other threads. */
+#define PARALLEL_MIN_BYTES (512 * 1024)
+
+typedef struct {
+  gint ref_count;
+  guchar *pixels;
+  int width;
+  int height;
+  int stride;
+  int band_rows;
+  int n_bands;
+  MemeBandFunc func;
+  gpointer user_data;
+  GCancellable *cancellable;
+  gint next_band;
+  GMutex lock;
+  GCond done_cond;
+  int bands_done;
+} TileJob;
+
+static GThreadPool *tile_pool;
+static int tile_threads;
+
+static void tile_job_unref (TileJob *job) {
+  if (!g_atomic_int_dec_and_test (&job->ref_count)) return;
+  g_mutex_clear (&job->lock);
+  g_cond_clear (&job->done_cond);
+  g_clear_object (&job->cancellable);
+  g_free (job);
+}
+
+/* Shared by the caller and the helpers. Every band gets claimed exactly once
+ * and counted as done, even when it is skipped after cancellation, so the
+ * caller knows when nobody can touch the pixels any more. */
+static void tile_job_work (TileJob *job) {
+  int band;
+
+  while ((band = g_atomic_int_add (&job->next_band, 1)) < job->n_bands) {
+    if (!g_cancellable_is_cancelled (job->cancellable)) {
+      int y0 = band * job->band_rows;
+      int rows = MIN (job->band_rows, job->height - y0);
+      job->func (job->pixels + (gsize)y0 * job->stride, job->width, rows, job->stride, y0, job->user_data);
+    }
+    g_mutex_lock (&job->lock);
+    if (++job->bands_done == job->n_bands) g_cond_signal (&job->done_cond);
+    g_mutex_unlock (&job->lock);
+  }
+}
+
+static void tile_helper (gpointer data, gpointer user_data) {
+  TileJob *job = (TileJob *)data;
+  /* Helpers that start after the caller has claimed every band just leave. */
+  tile_job_work (job);
+  tile_job_unref (job);
+}
+
+static GThreadPool * tile_pool_get (void) {
+  static gsize init = 0;
+  if (g_once_init_enter (&init)) {
+    tile_threads = MAX (1, (int)g_get_num_processors ());
+    if (tile_threads > 1)
+      tile_pool = g_thread_pool_new (tile_helper, NULL, tile_threads - 1, FALSE, NULL);
+    g_once_init_leave (&init, 1);
+  }
+  return tile_pool;
+}
+
+gboolean meme_tiles_run (guchar *pixels, int width, int height, int stride, int row_align,
+                         MemeBandFunc func, gpointer user_data, GCancellable *cancellable) {
+  GThreadPool *pool = tile_pool_get ();
+  TileJob *job;
+  gboolean ok;
+  int band_rows, n_helpers, i;
+
+  if (width <= 0 || height <= 0) return TRUE;
+  row_align = MAX (row_align, 1);
+
+  if (!pool || (gsize)stride * height < PARALLEL_MIN_BYTES) {
+    if (g_cancellable_is_cancelled (cancellable)) return FALSE;
+    func (pixels, width, height, stride, 0, user_data);
+    return TRUE;
+  }
+
+  /* Cache-sized bands, but at least a few per thread so the load evens out. */
+  band_rows = MIN (BAND_TARGET_BYTES / MAX (stride, 1), height / (tile_threads * 4));
+  band_rows = MAX (row_align, band_rows - band_rows % row_align);
+
+  job = g_new0 (TileJob, 1);
+  job->ref_count = 1;
+  job->pixels = pixels;
+  job->width = width;
+  job->height = height;
+  job->stride = stride;
+  job->band_rows = band_rows;
+  job->n_bands = (height + band_rows - 1) / band_rows;
+  job->func = func;
+  job->user_data = user_data;
+  job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  g_mutex_init (&job->lock);
+  g_cond_init (&job->done_cond);
+
+  n_helpers = MIN (tile_threads - 1, job->n_bands - 1);
+  for (i = 0; i < n_helpers; i++) {
+    g_atomic_int_inc (&job->ref_count);
+    g_thread_pool_push (pool, job, NULL);
+  }
+
+  tile_job_work (job);
+
+  g_mutex_lock (&job->lock);
+  while (job->bands_done < job->n_bands) g_cond_wait (&job->done_cond, &job->lock);
+  g_mutex_unlock (&job->lock);
+
+  ok = !g_cancellable_is_cancelled (cancellable);
+  tile_job_unref (job);
+  return ok;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <gio/gio.h>
+
+/* Row-band scheduler for per-pixel filters.
+ *
+ * The image is cut into bands of whole rows, sized to stay in L2, and the
+ * calling thread works through them together with a process-wide pool of
+ * helpers (one per extra core). Bands are claimed from an atomic counter, so
+ * a slow core simply takes fewer of them. A filter plugs in by providing a
+ * MemeBandFunc; @y0 is the band's first row in the image, which is all a
+ * position-dependent kernel needs to produce output identical to one pass. */
+
+typedef void (*MemeBandFunc) (guchar *band, int width, int height, int stride, int y0, gpointer user_data);
+
+/* Runs @func over every band of @pixels and returns once all of them are
+ * done. Band heights are multiples of @row_align (for kernels working on
+ * blocks of rows). Returns FALSE if @cancellable fired; bands not yet
+ * started are then skipped and the buffer is left partially filtered. */
+gboolean meme_tiles_run (guchar *pixels, int width, int height, int stride, int row_align,
+                         MemeBandFunc func, gpointer user_data, GCancellable *cancellable);
@@ -22,6 +22,7 @@
 #include <glib/gi18n.h>
 #include "myapp-application.h"
 #include "myapp-window.h"
+#include "meme-batch.h"
 
 struct _MyappApplication
 {
@@ -161,6 +162,26 @@ myapp_application_startup (GApplication *app)
                                          (const char *[]) { "<Control>question", NULL });
 }
 
+static gint
+myapp_application_handle_local_options (GApplication *app,
+                                        GVariantDict *options)
+{
+  const char *path = NULL;
+  gboolean ndjson = FALSE;
+  gint n_workers = 0;
+
+  /* --render/--batch run headless and exit before any window or display
+   * connection is created. */
+  if (g_variant_dict_lookup (options, "batch", "^&ay", &path))
+    ndjson = TRUE;
+  else if (!g_variant_dict_lookup (options, "render", "^&ay", &path))
+    return -1;
+
+  g_variant_dict_lookup (options, "jobs", "i", &n_workers);
+
+  return meme_batch_run (path, ndjson, n_workers);
+}
+
 static void
 myapp_application_class_init (MyappApplicationClass *klass)
 {
@@ -168,8 +189,21 @@ myapp_application_class_init (MyappApplicationClass *klass)
 
   app_class->startup = myapp_application_startup;
   app_class->activate = myapp_application_activate;
+  app_class->handle_local_options = myapp_application_handle_local_options;
 }
 
+static const GOptionEntry cmd_options[] = {
+  { "render", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, NULL,
+    "Render the meme job(s) in a JSON file without opening a window", "FILE" },
+  { "batch", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, NULL,
+    "Render one meme job per line of an NDJSON file without opening a window", "FILE" },
+  { "jobs", 'j', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, NULL,
+    "Number of worker threads for --render and --batch (default: one per core)", "N" },
+  G_OPTION_ENTRY_NULL
+};
+
 static void
 myapp_application_init (MyappApplication *self)
-{}
+{
+  g_application_add_main_option_entries (G_APPLICATION (self), cmd_options);
+}
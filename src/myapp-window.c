@@ -29,6 +29,13 @@
 
 #include "meme-core.h"
 #include "meme-renderer.h"
+#include "meme-compositor.h"
+#include "meme-canvas.h"
+#include "meme-history.h"
+#include "meme-spatial.h"
+#include "meme-loader.h"
+#include "meme-thumbnails.h"
+#include "meme-export.h"
 
 struct _MyappWindow {
   AdwApplicationWindow parent_instance;
@@ -37,11 +44,12 @@ struct _MyappWindow {
   AdwPreferencesGroup *transform_group;
   AdwOverlaySplitView *split_view;
   GtkStack        *content_stack;
-  GtkImage        *meme_preview;
+  MemeCanvas      *meme_preview;
   GtkImage        *add_text_button;
   AdwEntryRow     *layer_text_entry;
   AdwActionRow    *layer_font_size_row;
   GtkSpinButton   *layer_font_size;
+  AdwSwitchRow    *layer_auto_fit_row;
 
   GtkButton       *export_button;
   GtkButton       *load_image_button;
@@ -50,22 +58,44 @@ struct _MyappWindow {
   GtkButton       *import_template_button;
   GtkButton       *delete_template_button;
   GtkToggleButton *deep_fry_button;
-  GtkFlowBox      *template_gallery;
+  GtkGridView     *template_gallery;
+  GtkStringList   *template_list;       /* template paths, one per tile */
+  GtkSingleSelection *template_selection;
+  GFileMonitor    *template_monitor;    /* the user template directory */
+  GHashTable      *template_changes;    /* paths touched since the last flush */
+  guint            template_changes_id;
+  gint64           template_changes_since;
 
   GtkToggleButton *cinematic_button;
   GtkScale        *layer_opacity_scale;
   GtkScale        *layer_rotation_scale;
   AdwComboRow     *blend_mode_row;
   GtkButton       *delete_layer_button;
-
-  GdkPixbuf       *template_image;
-  GdkPixbuf       *final_meme;
-
-  GList           *layers;
-  ImageLayer      *selected_layer;
-
-  GList           *undo_stack;
-  GList           *redo_stack;
+  GtkButton       *raise_layer_button;
+  GtkButton       *lower_layer_button;
+
+  AdwComboRow     *export_format_row;
+  AdwSpinRow      *export_quality_row;
+  AdwSwitchRow    *export_limit_row;
+  AdwSpinRow      *export_max_size_row;
+
+  GdkPixbuf       *template_image;        /* as decoded; never rotated or cropped */
+  MemeGeometry     geometry;              /* rotations, flips and crops so far */
+  /* Set while template_image is a reduced copy of a template larger than
+   * MEME_LOADER_PROXY_SIZE; export decodes the original from here. */
+  char            *template_source;
+  char            *open_template_path;    /* what the gallery's delete button acts on */
+  GCancellable    *load_cancellable;      /* the template being decoded */
+  GCancellable    *document_cancellable;  /* sticker decodes for the current document */
+  GdkTexture      *final_meme;
+  guint32          noise_seed;
+  MemeCompositor  *compositor;
+
+  MemeLayerStack  *layers;
+  MemeLayerId      selected_id;
+  MemeSpatialIndex *hit_index;
+
+  MemeHistory     *history;
 
   DragType        drag_type;
   GtkGestureDrag *drag_gesture;
@@ -92,132 +122,194 @@ struct _MyappWindow {
   double crop_y;
   double crop_w;
   double crop_h;
+
+  guint   render_tick_id;
+  gboolean render_pending;
+  guint64 renders_requested;
+  guint64 renders_executed;
 };
 
+/* Directory events are coalesced until they stop for TEMPLATE_CHANGE_DELAY_MS,
+ * but a steady stream (a long rsync) still flushes every TEMPLATE_CHANGE_MAX_DELAY_MS. */
+#define TEMPLATE_CHANGE_DELAY_MS      250
+#define TEMPLATE_CHANGE_MAX_DELAY_MS  2000
+
 G_DEFINE_FINAL_TYPE (MyappWindow, myapp_window, ADW_TYPE_APPLICATION_WINDOW)
 
 static void sync_ui_with_layer(MyappWindow *self);
 static void render_meme (MyappWindow *self);
+static void queue_render (MyappWindow *self);
+static void update_overlay (MyappWindow *self);
 static void populate_template_gallery (MyappWindow *self);
 static void on_clear_clicked (MyappWindow *self);
-
-
-static void free_history_stack (GList **stack) {
-  GList *l;
-  for (l = *stack; l != NULL; l = l->next) {
-    meme_layer_list_free ((GList *)l->data);
-  }
-  g_list_free (*stack);
-  *stack = NULL;
-}
-
-static void push_undo (MyappWindow *self) {
-  free_history_stack (&self->redo_stack);
-  if (g_list_length (self->undo_stack) >= 20) {
-      GList *last = g_list_last (self->undo_stack);
-      meme_layer_list_free ((GList *)last->data);
-      self->undo_stack = g_list_delete_link (self->undo_stack, last);
-  }
-  self->undo_stack = g_list_prepend (self->undo_stack, meme_layer_list_copy (self->layers));
+static void update_template_actions (MyappWindow *self);
+
+/* NULL when nothing is selected; @content, if given, gets the layer's
+ * content. Only valid until the next insert or remove. */
+static LayerGeometry *selected_layer (MyappWindow *self, LayerContent **content) {
+  LayerGeometry *layer;
+  meme_layer_stack_lookup (self->layers, self->selected_id, &layer, content);
+  return layer;
 }
 
 static void perform_undo (MyappWindow *self) {
-  if (!self->undo_stack) return;
-  self->redo_stack = g_list_prepend (self->redo_stack, self->layers);
-  self->layers = (GList *)self->undo_stack->data;
-  self->undo_stack = g_list_delete_link (self->undo_stack, self->undo_stack);
-  self->selected_layer = NULL;
+  if (!meme_history_undo (self->history, self->layers, &self->geometry)) return;
+  self->selected_id = 0;
   sync_ui_with_layer (self);
-  render_meme (self);
+  queue_render (self);
 }
 
 static void perform_redo (MyappWindow *self) {
-  if (!self->redo_stack) return;
-  self->undo_stack = g_list_prepend (self->undo_stack, self->layers);
-  self->layers = (GList *)self->redo_stack->data;
-  self->redo_stack = g_list_delete_link (self->redo_stack, self->redo_stack);
-  self->selected_layer = NULL;
+  if (!meme_history_redo (self->history, self->layers, &self->geometry)) return;
+  self->selected_id = 0;
   sync_ui_with_layer (self);
-  render_meme (self);
+  queue_render (self);
 }
 
 
+/* The editor only ever shows the composite scaled down to the canvas, so it
+ * is rendered at the canvas' device pixel size (never above the template's
+ * own size, which is what a 1:1 view gets). Export renders at full size. */
+static double preview_scale (MyappWindow *self) {
+    GtkWidget *canvas = GTK_WIDGET (self->meme_preview);
+    double ww = gtk_widget_get_width (canvas);
+    double wh = gtk_widget_get_height (canvas);
+    double iw = meme_geometry_get_width (&self->geometry);
+    double ih = meme_geometry_get_height (&self->geometry);
+    int sf = gtk_widget_get_scale_factor (canvas);
+
+    if (ww <= 0 || wh <= 0) { ww = 740; wh = 740; }
+    return MIN (1.0, MIN (ww * sf / iw, wh * sf / ih));
+}
+
 static void render_meme (MyappWindow *self) {
     if (!self->template_image) return;
 
     
     if (self->final_meme) g_object_unref(self->final_meme);
-    self->final_meme = meme_render_composite(
+    self->final_meme = meme_compositor_render(
+        self->compositor,
         self->template_image,
+        &self->geometry,
         self->layers,
+        self->selected_id,
+        preview_scale(self),
         gtk_toggle_button_get_active(self->cinematic_button),
-        gtk_toggle_button_get_active(self->deep_fry_button)
+        gtk_toggle_button_get_active(self->deep_fry_button),
+        self->noise_seed
     );
 
-    GdkTexture *tex = meme_render_editor_overlay(
-        self->final_meme,
-        self->layers,
-        self->selected_layer,
-        gtk_toggle_button_get_active(self->crop_mode_button),
-        self->crop_x, self->crop_y, self->crop_w, self->crop_h
-    );
+    meme_canvas_set_document_size(self->meme_preview,
+                                  meme_geometry_get_width(&self->geometry),
+                                  meme_geometry_get_height(&self->geometry));
+    meme_canvas_set_texture(self->meme_preview, self->final_meme);
+    update_overlay(self);
+}
 
-    gtk_image_set_from_paintable(self->meme_preview, GDK_PAINTABLE(tex));
-    g_object_unref(tex);
+/* Input handlers only mark the document dirty; the actual render happens at
+ * most once per frame from the canvas frame clock, however many motion or
+ * value-changed events arrived in between. */
+static gboolean on_render_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data) {
+    MyappWindow *self = MYAPP_WINDOW (user_data);
+    self->render_tick_id = 0;
+    if (self->render_pending) {
+        self->render_pending = FALSE;
+        self->renders_executed++;
+        g_debug ("render %" G_GUINT64_FORMAT " for %" G_GUINT64_FORMAT " requests",
+                 self->renders_executed, self->renders_requested);
+        render_meme (self);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void queue_render (MyappWindow *self) {
+    /* Layer sizes come from the layout pass, not from painting, so hit
+     * testing is current as soon as something changes. */
+    if (self->template_image)
+        meme_spatial_index_sync(self->hit_index, self->layers,
+                                meme_geometry_get_width(&self->geometry),
+                                meme_geometry_get_height(&self->geometry));
+    self->renders_requested++;
+    self->render_pending = TRUE;
+    if (self->render_tick_id == 0)
+        self->render_tick_id = gtk_widget_add_tick_callback (GTK_WIDGET (self->meme_preview), on_render_tick, self, NULL);
+}
+
+/* Selection and crop chrome are drawn by the canvas itself, so changing
+ * them never re-renders the composite. */
+static void update_overlay (MyappWindow *self) {
+    meme_canvas_set_selection(self->meme_preview, selected_layer(self, NULL));
+    meme_canvas_set_crop(self->meme_preview,
+                         gtk_toggle_button_get_active(self->crop_mode_button),
+                         self->crop_x, self->crop_y, self->crop_w, self->crop_h);
 }
 
-static void on_text_changed (MyappWindow *self) { if (self->template_image) render_meme (self); }
-static void on_deep_fry_toggled (GtkToggleButton *btn, MyappWindow *self) { render_meme (self); }
+static void on_text_changed (MyappWindow *self) { if (self->template_image) queue_render (self); }
+static void on_deep_fry_toggled (GtkToggleButton *btn, MyappWindow *self) { queue_render (self); }
 
 static void on_layer_text_changed (MyappWindow *self) {
-  if (self->selected_layer && self->selected_layer->type == LAYER_TYPE_TEXT) {
-      g_free (self->selected_layer->text);
-      self->selected_layer->text = g_strdup (gtk_editable_get_text (GTK_EDITABLE (self->layer_text_entry)));
-      self->selected_layer->font_size = gtk_spin_button_get_value (self->layer_font_size);
-      render_meme (self);
+  LayerContent *content;
+  LayerGeometry *layer = selected_layer (self, &content);
+  if (layer && content->type == LAYER_TYPE_TEXT) {
+      g_ref_string_release (content->text);
+      content->text = g_ref_string_new (gtk_editable_get_text (GTK_EDITABLE (self->layer_text_entry)));
+      if (!content->auto_fit) content->font_size = gtk_spin_button_get_value (self->layer_font_size);
+      meme_layer_layout (layer, content);
+      if (content->auto_fit) {
+          g_signal_handlers_block_by_func (self->layer_font_size, on_layer_text_changed, self);
+          gtk_spin_button_set_value (self->layer_font_size, content->font_size);
+          g_signal_handlers_unblock_by_func (self->layer_font_size, on_layer_text_changed, self);
+      }
+      queue_render (self);
   }
 }
 
-static void on_add_text_clicked (MyappWindow *self) {
-  push_undo (self);
-  ImageLayer *new_layer = g_new0 (ImageLayer, 1);
-  new_layer->type = LAYER_TYPE_TEXT;
-  new_layer->text = g_strdup ("Text");
-  new_layer->font_size = 60.0;
-  new_layer->x = 0.5; new_layer->y = 0.5;
-  new_layer->scale = 1.0; new_layer->opacity = 1.0;
-  new_layer->blend_mode = BLEND_NORMAL;
-  self->layers = g_list_append (self->layers, new_layer);
-  self->selected_layer = new_layer;
-  sync_ui_with_layer(self);
-  render_meme (self);
+/* Turning auto-fit on freezes the layer's current box; from then on the
+ * text wraps to it and the font size follows the text. */
+static void on_auto_fit_changed (MyappWindow *self) {
+  LayerContent *content;
+  LayerGeometry *layer = selected_layer (self, &content);
+  gboolean active = adw_switch_row_get_active (self->layer_auto_fit_row);
+  if (!layer || content->type != LAYER_TYPE_TEXT || content->auto_fit == active) return;
+  meme_history_record_modify (self->history, self->layers, layer->id);
+  content->auto_fit = active;
+  content->box_width = active ? layer->width : 0;
+  content->box_height = active ? layer->height : 0;
+  meme_layer_layout (layer, content);
+  sync_ui_with_layer (self);
+  queue_render (self);
 }
 
-static void update_template_image (MyappWindow *self, GdkPixbuf *new_pixbuf) {
-  if (!new_pixbuf) return;
-  push_undo (self);
-  if (self->template_image) g_object_unref (self->template_image);
-  self->template_image = new_pixbuf;
-  render_meme (self);
+static void on_add_text_clicked (MyappWindow *self) {
+  ImageLayer new_layer = { 0 };
+  new_layer.content.type = LAYER_TYPE_TEXT;
+  new_layer.content.text = g_ref_string_new ("Text");
+  new_layer.content.font_size = 60.0;
+  new_layer.content.opacity = 1.0;
+  new_layer.content.blend_mode = BLEND_NORMAL;
+  new_layer.geometry.x = 0.5; new_layer.geometry.y = 0.5;
+  new_layer.geometry.scale = 1.0;
+  meme_layer_layout (&new_layer.geometry, &new_layer.content);
+  self->selected_id = meme_layer_stack_insert (self->layers, -1, &new_layer);
+  meme_history_record_insert (self->history, self->selected_id);
+  sync_ui_with_layer(self);
+  queue_render (self);
 }
 
+/* Geometry edits never touch the template's pixels, so they cost nothing
+ * however large it is, and undo just puts the old geometry back. */
 static void on_rotate_clicked (GtkWidget *btn, MyappWindow *self) {
-  gboolean clockwise;
-  GdkPixbuf *new_pix;
   if (!self->template_image) return;
-  clockwise = (btn == GTK_WIDGET (self->rotate_right_button));
-  new_pix = gdk_pixbuf_rotate_simple (self->template_image,
-      clockwise ? GDK_PIXBUF_ROTATE_CLOCKWISE : GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE);
-  update_template_image (self, new_pix);
+  meme_history_record_geometry (self->history, &self->geometry);
+  meme_geometry_rotate (&self->geometry, btn == GTK_WIDGET (self->rotate_right_button));
+  queue_render (self);
 }
 
 static void on_flip_clicked (GtkWidget *btn, MyappWindow *self) {
-  gboolean horizontal;
-  GdkPixbuf *new_pix;
   if (!self->template_image) return;
-  horizontal = (btn == GTK_WIDGET (self->flip_h_button));
-  new_pix = gdk_pixbuf_flip (self->template_image, horizontal);
-  update_template_image (self, new_pix);
+  meme_history_record_geometry (self->history, &self->geometry);
+  meme_geometry_flip (&self->geometry, btn == GTK_WIDGET (self->flip_h_button));
+  queue_render (self);
 }
 
 static void on_crop_preset_clicked (GtkWidget *btn, MyappWindow *self) {
@@ -225,8 +317,8 @@ static void on_crop_preset_clicked (GtkWidget *btn, MyappWindow *self) {
   double target_ratio = 1.0;
   double current_ratio;
   if (!self->template_image) return;
-  w = gdk_pixbuf_get_width (self->template_image);
-  h = gdk_pixbuf_get_height (self->template_image);
+  w = meme_geometry_get_width (&self->geometry);
+  h = meme_geometry_get_height (&self->geometry);
   current_ratio = (double)w / (double)h;
 
   if (btn == GTK_WIDGET (self->crop_square_button)) target_ratio = 1.0;
@@ -244,7 +336,7 @@ static void on_crop_preset_clicked (GtkWidget *btn, MyappWindow *self) {
       self->crop_y = (1.0 - self->crop_h) / 2.0;
       self->crop_x = 0.0;
   }
-  render_meme(self);
+  update_overlay(self);
 }
 
 static void on_crop_mode_toggled (GtkToggleButton *btn, MyappWindow *self) {
@@ -259,95 +351,122 @@ static void on_crop_mode_toggled (GtkToggleButton *btn, MyappWindow *self) {
   } else {
     gtk_widget_set_cursor (GTK_WIDGET (self->meme_preview), NULL);
   }
-  render_meme(self);
+  update_overlay(self);
 }
 
 static void on_apply_crop_clicked (MyappWindow *self) {
   if (!self->template_image) return;
-  int iw = gdk_pixbuf_get_width(self->template_image);
-  int ih = gdk_pixbuf_get_height(self->template_image);
+  int iw = meme_geometry_get_width(&self->geometry);
+  int ih = meme_geometry_get_height(&self->geometry);
   int x = self->crop_x * iw;
   int y = self->crop_y * ih;
   int w = self->crop_w * iw;
   int h = self->crop_h * ih;
   if (w <= 0 || h <= 0) return;
 
-  push_undo(self);
-  GList *l;
-  for (l = self->layers; l != NULL; l = l->next) {
-      ImageLayer *layer = (ImageLayer *)l->data;
+  /* Moving the layers and cropping the template undo as one step. */
+  meme_history_begin (self->history);
+  guint i;
+  for (i = 0; i < meme_layer_stack_get_n_layers (self->layers); i++) {
+      LayerGeometry *layer = meme_layer_stack_get_geometry (self->layers, i);
+      meme_history_record_modify (self->history, self->layers, layer->id);
       double abs_x = layer->x * iw;
       double abs_y = layer->y * ih;
       layer->x = (abs_x - x) / (double)w;
       layer->y = (abs_y - y) / (double)h;
   }
-  GdkPixbuf *sub = gdk_pixbuf_new_subpixbuf(self->template_image, x, y, w, h);
-  GdkPixbuf *new_pix = gdk_pixbuf_copy(sub);
-  g_object_unref(sub);
-  update_template_image(self, new_pix); 
+  meme_history_record_geometry (self->history, &self->geometry);
+  meme_geometry_crop (&self->geometry, &(cairo_rectangle_int_t) { x, y, w, h });
+  meme_history_end (self->history);
+  queue_render (self);
   self->crop_x = 0; self->crop_y = 0; self->crop_w = 1; self->crop_h = 1;
   gtk_toggle_button_set_active(self->crop_mode_button, FALSE);
 }
 
 static void sync_ui_with_layer(MyappWindow *self) {
-    gboolean sensitive = (self->selected_layer != NULL);
-    gboolean is_text = (sensitive && self->selected_layer->type == LAYER_TYPE_TEXT);
+    LayerContent *content;
+    LayerGeometry *layer = selected_layer(self, &content);
+    gboolean sensitive = (layer != NULL);
+    gboolean is_text = (sensitive && content->type == LAYER_TYPE_TEXT);
+    int position = sensitive ? meme_layer_stack_find(self->layers, layer->id) : -1;
 
     g_signal_handlers_block_by_func(self->layer_opacity_scale, on_text_changed, self);
     g_signal_handlers_block_by_func(self->layer_rotation_scale, on_text_changed, self);
     g_signal_handlers_block_by_func(self->layer_text_entry, on_layer_text_changed, self);
     g_signal_handlers_block_by_func(self->layer_font_size, on_layer_text_changed, self);
+    g_signal_handlers_block_by_func(self->layer_auto_fit_row, on_auto_fit_changed, self);
 
     if (sensitive) {
-        gtk_range_set_value(GTK_RANGE(self->layer_opacity_scale), self->selected_layer->opacity);
-        gtk_range_set_value(GTK_RANGE(self->layer_rotation_scale), self->selected_layer->rotation);
-        adw_combo_row_set_selected(self->blend_mode_row, self->selected_layer->blend_mode);
+        gtk_range_set_value(GTK_RANGE(self->layer_opacity_scale), content->opacity);
+        gtk_range_set_value(GTK_RANGE(self->layer_rotation_scale), layer->rotation);
+        adw_combo_row_set_selected(self->blend_mode_row, content->blend_mode);
         if (is_text) {
-             gtk_editable_set_text(GTK_EDITABLE(self->layer_text_entry), self->selected_layer->text);
-             gtk_spin_button_set_value(self->layer_font_size, self->selected_layer->font_size);
+             gtk_editable_set_text(GTK_EDITABLE(self->layer_text_entry), content->text);
+             gtk_spin_button_set_value(self->layer_font_size, content->font_size);
+             adw_switch_row_set_active(self->layer_auto_fit_row, content->auto_fit);
         }
     }
     gtk_widget_set_visible(GTK_WIDGET(self->layer_text_entry), is_text);
     gtk_widget_set_visible(GTK_WIDGET(self->layer_font_size_row), is_text);
+    gtk_widget_set_visible(GTK_WIDGET(self->layer_auto_fit_row), is_text);
+    gtk_widget_set_sensitive(GTK_WIDGET(self->layer_font_size), !(is_text && content->auto_fit));
     gtk_widget_set_sensitive(GTK_WIDGET(self->layer_opacity_scale), sensitive);
     gtk_widget_set_sensitive(GTK_WIDGET(self->layer_rotation_scale), sensitive);
     gtk_widget_set_sensitive(GTK_WIDGET(self->blend_mode_row), sensitive);
     gtk_widget_set_sensitive(GTK_WIDGET(self->delete_layer_button), sensitive);
+    gtk_widget_set_sensitive(GTK_WIDGET(self->raise_layer_button),
+                             sensitive && (guint)position + 1 < meme_layer_stack_get_n_layers(self->layers));
+    gtk_widget_set_sensitive(GTK_WIDGET(self->lower_layer_button), position > 0);
 
     g_signal_handlers_unblock_by_func(self->layer_opacity_scale, on_text_changed, self);
     g_signal_handlers_unblock_by_func(self->layer_rotation_scale, on_text_changed, self);
     g_signal_handlers_unblock_by_func(self->layer_text_entry, on_layer_text_changed, self);
     g_signal_handlers_unblock_by_func(self->layer_font_size, on_layer_text_changed, self);
+    g_signal_handlers_unblock_by_func(self->layer_auto_fit_row, on_auto_fit_changed, self);
 }
 
 static void on_layer_control_changed (MyappWindow *self) {
-  if (self->selected_layer) {
-     self->selected_layer->opacity = gtk_range_get_value(GTK_RANGE(self->layer_opacity_scale));
-     self->selected_layer->rotation = gtk_range_get_value(GTK_RANGE(self->layer_rotation_scale));
-     self->selected_layer->blend_mode = (BlendMode)adw_combo_row_get_selected(self->blend_mode_row);
-     render_meme(self);
+  LayerContent *content;
+  LayerGeometry *layer = selected_layer(self, &content);
+  if (layer) {
+     content->opacity = gtk_range_get_value(GTK_RANGE(self->layer_opacity_scale));
+     layer->rotation = gtk_range_get_value(GTK_RANGE(self->layer_rotation_scale));
+     content->blend_mode = (BlendMode)adw_combo_row_get_selected(self->blend_mode_row);
+     queue_render(self);
   }
 }
 
 static void on_delete_layer_clicked (MyappWindow *self) {
-  if (self->selected_layer) {
-    push_undo (self);
-    self->layers = g_list_remove(self->layers, self->selected_layer);
-    meme_layer_free(self->selected_layer);
-    self->selected_layer = NULL;
+  if (self->selected_id) {
+    /* The history keeps the layer so the delete can be undone. */
+    meme_history_record_remove (self->history, self->layers, self->selected_id);
+    self->selected_id = 0;
     sync_ui_with_layer(self);
-    render_meme(self);
+    queue_render(self);
   }
 }
 
+/* Raising or lowering swaps two entries of the stack's order; the layers
+ * themselves stay where they are. */
+static void on_restack_layer_clicked (GtkWidget *btn, MyappWindow *self) {
+  int position = meme_layer_stack_find (self->layers, self->selected_id);
+  if (position < 0) return;
+  if (btn == GTK_WIDGET (self->raise_layer_button)) position++;
+  else if (position > 0) position--;
+  else return;
+  meme_history_record_move (self->history, self->layers, self->selected_id, position);
+  sync_ui_with_layer (self);
+  queue_render (self);
+}
+
 
 static void on_mouse_move (GtkEventControllerMotion *controller, double x, double y, MyappWindow *self) {
   double ix, iy, img_w, img_h;
   if (!self->template_image) { gtk_widget_set_cursor (GTK_WIDGET (self->meme_preview), NULL); return; }
   
-  meme_get_image_coordinates(GTK_WIDGET(self->meme_preview), self->template_image, x, y, &ix, &iy);
-  img_w = gdk_pixbuf_get_width(self->template_image);
-  img_h = gdk_pixbuf_get_height(self->template_image);
+  img_w = meme_geometry_get_width(&self->geometry);
+  img_h = meme_geometry_get_height(&self->geometry);
+  meme_get_image_coordinates(GTK_WIDGET(self->meme_preview), img_w, img_h, x, y, &ix, &iy);
 
   if (gtk_toggle_button_get_active(self->crop_mode_button)) {
      ResizeHandle h = meme_get_crop_handle_at_position(ix, iy, self->crop_x, self->crop_y, self->crop_w, self->crop_h);
@@ -370,28 +489,18 @@ static void on_mouse_move (GtkEventControllerMotion *controller, double x, doubl
   }
 
   // Layer hover
-  GList *l;
-  gboolean found = FALSE;
-  for (l = g_list_last(self->layers); l != NULL; l = l->prev) {
-      ImageLayer *layer = (ImageLayer *)l->data;
-      double half_w = (layer->width * layer->scale) / (2.0 * img_w);
-      double half_h = (layer->height * layer->scale) / (2.0 * img_h);
-      if (ix >= layer->x - half_w && ix <= layer->x + half_w &&
-          iy >= layer->y - half_h && iy <= layer->y + half_h) {
-          gtk_widget_set_cursor_from_name (GTK_WIDGET (self->meme_preview), "move");
-          found = TRUE;
-          break;
-      }
-  }
-  if (!found) gtk_widget_set_cursor (GTK_WIDGET (self->meme_preview), NULL);
+  if (meme_spatial_index_pick (self->hit_index, ix * img_w, iy * img_h))
+      gtk_widget_set_cursor_from_name (GTK_WIDGET (self->meme_preview), "move");
+  else
+      gtk_widget_set_cursor (GTK_WIDGET (self->meme_preview), NULL);
 }
 
 static void on_drag_begin (GtkGestureDrag *gesture, double x, double y, MyappWindow *self) {
   double ix, iy, img_w, img_h;
   if (!self->template_image) return;
-  meme_get_image_coordinates(GTK_WIDGET(self->meme_preview), self->template_image, x, y, &ix, &iy);
-  img_w = gdk_pixbuf_get_width(self->template_image);
-  img_h = gdk_pixbuf_get_height(self->template_image);
+  img_w = meme_geometry_get_width(&self->geometry);
+  img_h = meme_geometry_get_height(&self->geometry);
+  meme_get_image_coordinates(GTK_WIDGET(self->meme_preview), img_w, img_h, x, y, &ix, &iy);
 
   if (gtk_toggle_button_get_active(self->crop_mode_button)) {
       self->active_crop_handle = meme_get_crop_handle_at_position(ix, iy, self->crop_x, self->crop_y, self->crop_w, self->crop_h);
@@ -405,46 +514,41 @@ static void on_drag_begin (GtkGestureDrag *gesture, double x, double y, MyappWin
       return;
   }
 
-  GList *l;
-  for (l = g_list_last(self->layers); l != NULL; l = l->prev) {
-     ImageLayer *layer = (ImageLayer *)l->data;
-     double hw = (layer->width * layer->scale) / (2.0 * img_w);
-     double hh = (layer->height * layer->scale) / (2.0 * img_h);
-     double l_left = layer->x - hw, l_right = layer->x + hw;
-     double l_top = layer->y - hh, l_bot = layer->y + hh;
-     
-     
-     double cx = 20.0 / img_w;
-     gboolean corner = (fabs(ix - l_left) < cx || fabs(ix - l_right) < cx) && (fabs(iy - l_top) < cx || fabs(iy - l_bot) < cx);
-
-     if (layer == self->selected_layer && corner) {
-         push_undo(self);
+  /* The selected layer's corner handles win over whatever lies on top. */
+  LayerGeometry *layer = selected_layer(self, NULL);
+  if (layer) {
+     double lx, ly, grab = 20.0;
+     meme_layer_to_local (layer, img_w, img_h, ix * img_w, iy * img_h, &lx, &ly);
+     if (fabs (fabs (lx) - layer->width * layer->scale / 2.0) < grab &&
+         fabs (fabs (ly) - layer->height * layer->scale / 2.0) < grab) {
+         meme_history_record_modify (self->history, self->layers, layer->id);
          self->drag_type = DRAG_TYPE_IMAGE_RESIZE;
-         self->selected_layer = layer;
          self->drag_obj_start_scale = layer->scale;
          self->drag_start_x = ix * img_w; self->drag_start_y = iy * img_h; // Abs pixel coords for resize logic
-         sync_ui_with_layer(self); render_meme(self); return;
+         sync_ui_with_layer(self); update_overlay(self); return;
      }
+  }
 
-     if (ix >= l_left && ix <= l_right && iy >= l_top && iy <= l_bot) {
-         push_undo(self);
-         self->drag_type = DRAG_TYPE_IMAGE_MOVE;
-         self->selected_layer = layer;
-         self->drag_obj_start_x = layer->x; self->drag_obj_start_y = layer->y;
-         self->drag_start_x = ix; self->drag_start_y = iy;
-         sync_ui_with_layer(self); render_meme(self); return;
-     }
+  if (meme_layer_stack_lookup (self->layers, meme_spatial_index_pick (self->hit_index, ix * img_w, iy * img_h),
+                               &layer, NULL)) {
+     meme_history_record_modify (self->history, self->layers, layer->id);
+     self->drag_type = DRAG_TYPE_IMAGE_MOVE;
+     self->selected_id = layer->id;
+     self->drag_obj_start_x = layer->x; self->drag_obj_start_y = layer->y;
+     self->drag_start_x = ix; self->drag_start_y = iy;
+     sync_ui_with_layer(self); update_overlay(self); return;
   }
-  if (self->selected_layer) { self->selected_layer = NULL; sync_ui_with_layer(self); render_meme(self); }
+  if (self->selected_id) { self->selected_id = 0; sync_ui_with_layer(self); update_overlay(self); }
 }
 
 static void on_drag_update (GtkGestureDrag *gesture, double offset_x, double offset_y, MyappWindow *self) {
   double dx, dy, img_w, img_h;
   double ww, wh, wr, hr, s;
+  LayerGeometry *layer;
   if (self->drag_type == DRAG_TYPE_NONE || !self->template_image) return;
 
-  img_w = gdk_pixbuf_get_width(self->template_image);
-  img_h = gdk_pixbuf_get_height(self->template_image);
+  img_w = meme_geometry_get_width(&self->geometry);
+  img_h = meme_geometry_get_height(&self->geometry);
   ww = gtk_widget_get_width(GTK_WIDGET(self->meme_preview));
   wh = gtk_widget_get_height(GTK_WIDGET(self->meme_preview));
   wr = ww/img_w; hr = wh/img_h;
@@ -476,45 +580,116 @@ static void on_drag_update (GtkGestureDrag *gesture, double offset_x, double off
       }
       self->crop_x = nx; self->crop_y = ny; self->crop_w = nw; self->crop_h = nh;
   }
-  else if (self->drag_type == DRAG_TYPE_IMAGE_MOVE && self->selected_layer) {
-      self->selected_layer->x = CLAMP(self->drag_obj_start_x + dx, 0.0, 1.0);
-      self->selected_layer->y = CLAMP(self->drag_obj_start_y + dy, 0.0, 1.0);
+  if (self->drag_type == DRAG_TYPE_CROP_MOVE || self->drag_type == DRAG_TYPE_CROP_RESIZE) {
+      update_overlay(self);
+      return;
+  }
+  layer = selected_layer(self, NULL);
+  if (self->drag_type == DRAG_TYPE_IMAGE_MOVE && layer) {
+      layer->x = CLAMP(self->drag_obj_start_x + dx, 0.0, 1.0);
+      layer->y = CLAMP(self->drag_obj_start_y + dy, 0.0, 1.0);
   }
-  else if (self->drag_type == DRAG_TYPE_IMAGE_RESIZE && self->selected_layer) {
-      double cx = self->selected_layer->x * img_w, cy = self->selected_layer->y * img_h;
+  else if (self->drag_type == DRAG_TYPE_IMAGE_RESIZE && layer) {
+      double cx = layer->x * img_w, cy = layer->y * img_h;
       double sdx = self->drag_start_x - cx, sdy = self->drag_start_y - cy;
       double cdx = (self->drag_start_x + offset_x/s) - cx, cdy = (self->drag_start_y + offset_y/s) - cy;
       double dist_s = sqrt(sdx*sdx + sdy*sdy), dist_c = sqrt(cdx*cdx + cdy*cdy);
-      if (dist_s > 5.0) self->selected_layer->scale = CLAMP(self->drag_obj_start_scale * (dist_c/dist_s), 0.1, 5.0);
+      if (dist_s > 5.0) layer->scale = CLAMP(self->drag_obj_start_scale * (dist_c/dist_s), 0.1, 5.0);
   }
-  render_meme(self);
+  queue_render(self);
 }
 
 static void on_drag_end (GtkGestureDrag *g, double x, double y, MyappWindow *self) { self->drag_type = DRAG_TYPE_NONE; }
 
 //File Handling
+static void on_template_loaded (GObject *s, GAsyncResult *r, gpointer d) {
+  GError *error = NULL;
+  GdkPixbuf *pixbuf = meme_pixbuf_load_finish (r, &error);
+  /* Superseded by a newer selection, or the window is gone. */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) { g_error_free (error); return; }
+
+  MyappWindow *self = MYAPP_WINDOW (d);
+  /* Stops the placeholder decode if it is somehow still running. */
+  g_cancellable_cancel (self->load_cancellable);
+  g_clear_object (&self->load_cancellable);
+  if (!pixbuf) {
+      g_warning ("Failed to load template: %s", error->message);
+      g_error_free (error);
+      on_clear_clicked (self);
+      return;
+  }
+
+  self->template_image = pixbuf;
+  meme_geometry_init (&self->geometry, gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf));
+  int source_w, source_h;
+  meme_pixbuf_get_source_size (pixbuf, &source_w, &source_h);
+  /* Decoded at full size; there is nothing better to export from. */
+  if (source_w <= gdk_pixbuf_get_width (pixbuf)) g_clear_pointer (&self->template_source, g_free);
+  gtk_stack_set_visible_child_name (self->content_stack, "content");
+  gtk_widget_set_sensitive (GTK_WIDGET (self->add_text_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->export_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->clear_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->add_image_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->deep_fry_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->cinematic_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->crop_mode_button), TRUE);
+  queue_render (self);
+}
+
+/* Shown, stretched to the canvas, until the full decode lands. */
+static void on_placeholder_loaded (GObject *s, GAsyncResult *r, gpointer d) {
+  GdkPixbuf *pixbuf = meme_pixbuf_load_finish (r, NULL);
+  if (!pixbuf) return;
+
+  MyappWindow *self = MYAPP_WINDOW (d);
+  GdkTexture *texture = gdk_texture_new_for_pixbuf (pixbuf);
+  gtk_stack_set_visible_child_name (self->content_stack, "content");
+  meme_canvas_set_document_size (self->meme_preview, gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf));
+  meme_canvas_set_texture (self->meme_preview, texture);
+  g_object_unref (texture);
+  g_object_unref (pixbuf);
+}
+
+static void cancel_loads (MyappWindow *self) {
+  g_cancellable_cancel (self->load_cancellable);
+  g_clear_object (&self->load_cancellable);
+  g_cancellable_cancel (self->document_cancellable);
+  g_clear_object (&self->document_cancellable);
+}
+
+/* Starts a new document from @path (a file or resource:// URI). Decoding
+ * runs in worker threads: a small placeholder first, then the full image.
+ * Opening another template cancels whatever is still in flight. */
+static void open_template (MyappWindow *self, const char *path) {
+  cancel_loads (self);
+  self->load_cancellable = g_cancellable_new ();
+  self->document_cancellable = g_cancellable_new ();
+
+  g_clear_object (&self->template_image);
+  g_free (self->template_source);
+  self->template_source = g_strdup (path);
+  g_free (self->open_template_path);
+  self->open_template_path = g_strdup (path);
+  update_template_actions (self);
+  g_clear_object (&self->final_meme);
+  meme_layer_stack_clear (self->layers);
+  self->selected_id = 0;
+  meme_history_clear (self->history);
+  sync_ui_with_layer (self);
+  /* New document, new grain; it stays put across re-renders and export. */
+  self->noise_seed = g_random_int ();
+
+  meme_pixbuf_load_async (path, MEME_LOADER_PLACEHOLDER_SIZE, self->load_cancellable, on_placeholder_loaded, self);
+  meme_pixbuf_load_async (path, MEME_LOADER_PROXY_SIZE, self->load_cancellable, on_template_loaded, self);
+}
+
 static void on_load_image_response (GObject *s, GAsyncResult *r, gpointer d) {
   GtkFileDialog *dialog = GTK_FILE_DIALOG (s);
   MyappWindow *self = MYAPP_WINDOW (d);
   GFile *file = gtk_file_dialog_open_finish (dialog, r, NULL);
   if (file) {
       char *path = g_file_get_path (file);
-      g_clear_object (&self->template_image);
-      self->template_image = gdk_pixbuf_new_from_file (path, NULL);
-      if (self->layers) { meme_layer_list_free (self->layers); self->layers = NULL; self->selected_layer = NULL; }
-      free_history_stack (&self->undo_stack); free_history_stack (&self->redo_stack);
-      if (self->template_image) {
-          gtk_stack_set_visible_child_name (self->content_stack, "content");
-          gtk_widget_set_sensitive(GTK_WIDGET(self->add_text_button), TRUE);
-          gtk_widget_set_sensitive(GTK_WIDGET(self->export_button), TRUE);
-          gtk_widget_set_sensitive(GTK_WIDGET(self->clear_button), TRUE);
-          gtk_widget_set_sensitive(GTK_WIDGET(self->add_image_button), TRUE);
-          gtk_widget_set_sensitive(GTK_WIDGET(self->deep_fry_button), TRUE);
-          gtk_widget_set_sensitive(GTK_WIDGET(self->cinematic_button), TRUE);
-          gtk_widget_set_sensitive(GTK_WIDGET(self->crop_mode_button), TRUE);
-                    
-          render_meme(self);
-      }
+      open_template (self, path);
       g_free (path); g_object_unref (file);
   }
 }
@@ -524,23 +699,34 @@ static void on_load_image_clicked (MyappWindow *self) {
   gtk_file_dialog_open (dialog, GTK_WINDOW (self), NULL, on_load_image_response, self);
 }
 
+static void on_sticker_loaded (GObject *s, GAsyncResult *r, gpointer d) {
+    GError *error = NULL;
+    ImageLayer new_layer = { 0 };
+    new_layer.content.pixbuf = meme_pixbuf_load_finish (r, &error);
+    /* Cancelled means the window or the document it was for is gone. */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) { g_error_free (error); return; }
+
+    MyappWindow *self = MYAPP_WINDOW (d);
+    if (!new_layer.content.pixbuf) {
+        g_warning ("Failed to load image: %s", error->message);
+        g_error_free (error);
+        return;
+    }
+    new_layer.geometry.width = gdk_pixbuf_get_width(new_layer.content.pixbuf);
+    new_layer.geometry.height = gdk_pixbuf_get_height(new_layer.content.pixbuf);
+    new_layer.geometry.x=0.5; new_layer.geometry.y=0.5; new_layer.geometry.scale=1.0; new_layer.content.opacity=1.0;
+    self->selected_id = meme_layer_stack_insert(self->layers, -1, &new_layer);
+    meme_history_record_insert(self->history, self->selected_id);
+    sync_ui_with_layer(self); queue_render(self);
+}
+
 static void on_add_image_response (GObject *s, GAsyncResult *r, gpointer d) {
     GtkFileDialog *dialog = GTK_FILE_DIALOG (s);
     MyappWindow *self = MYAPP_WINDOW (d);
     GFile *file = gtk_file_dialog_open_finish (dialog, r, NULL);
     if (file) {
         char *path = g_file_get_path (file);
-        ImageLayer *new_layer = g_new0(ImageLayer, 1);
-        new_layer->pixbuf = gdk_pixbuf_new_from_file(path, NULL);
-        if (new_layer->pixbuf) {
-            push_undo(self);
-            new_layer->width = gdk_pixbuf_get_width(new_layer->pixbuf);
-            new_layer->height = gdk_pixbuf_get_height(new_layer->pixbuf);
-            new_layer->x=0.5; new_layer->y=0.5; new_layer->scale=1.0; new_layer->opacity=1.0;
-            self->layers = g_list_append(self->layers, new_layer);
-            self->selected_layer = new_layer;
-            sync_ui_with_layer(self); render_meme(self);
-        }
+        meme_pixbuf_load_async (path, 0, self->document_cancellable, on_sticker_loaded, self);
         g_free(path); g_object_unref(file);
     }
 }
@@ -550,53 +736,131 @@ static void on_add_image_clicked (MyappWindow *self) {
     gtk_file_dialog_open (dialog, GTK_WINDOW (self), NULL, on_add_image_response, self);
 }
 
+/* An export keeps the application running until the file is written, even
+ * if its window is closed meanwhile; the window is only weakly referenced. */
+typedef struct {
+  GApplication *app;
+  GWeakRef window;
+} ExportRequest;
+
+static void on_export_finished (GObject *s, GAsyncResult *r, gpointer d) {
+  ExportRequest *request = d;
+  GtkWindow *window = g_weak_ref_get (&request->window);
+  GError *error = NULL;
+
+  if (!meme_export_finish (r, &error)) {
+    if (window) {
+      GtkAlertDialog *alert = gtk_alert_dialog_new ("Export Failed");
+      gtk_alert_dialog_set_detail (alert, error->message);
+      gtk_alert_dialog_show (alert, window);
+      g_object_unref (alert);
+    } else {
+      g_printerr ("Export failed: %s\n", error->message);
+    }
+    g_error_free (error);
+  }
+
+  g_clear_object (&window);
+  g_weak_ref_clear (&request->window);
+  g_application_release (request->app);
+  g_object_unref (request->app);
+  g_free (request);
+}
+
 static void on_export_response (GObject *s, GAsyncResult *r, gpointer d) {
   GtkFileDialog *dialog = GTK_FILE_DIALOG (s);
   MyappWindow *self = MYAPP_WINDOW (d);
   GFile *file = gtk_file_dialog_save_finish (dialog, r, NULL);
-  if (file && self->final_meme) {
-      GdkPixbuf *save = self->final_meme;
-      if (gtk_toggle_button_get_active(self->crop_mode_button)) {
-          int iw = gdk_pixbuf_get_width(save); int ih = gdk_pixbuf_get_height(save);
-          save = gdk_pixbuf_new_subpixbuf(save, self->crop_x*iw, self->crop_y*ih, self->crop_w*iw, self->crop_h*ih);
-      } else {
-          g_object_ref(save);
-      }
-      gdk_pixbuf_save (save, g_file_get_path (file), "png", NULL, NULL);
-      g_object_unref (save); g_object_unref (file);
+  if (file && self->template_image) {
+      ExportRequest *request = g_new0 (ExportRequest, 1);
+      MemeExportOptions options = { 0 };
+      cairo_rectangle_t crop = { self->crop_x, self->crop_y, self->crop_w, self->crop_h };
+      options.format = adw_combo_row_get_selected (self->export_format_row);
+      options.quality = (int)adw_spin_row_get_value (self->export_quality_row);
+      if (adw_switch_row_get_active (self->export_limit_row))
+          options.max_bytes = (gsize)adw_spin_row_get_value (self->export_max_size_row) * 1024;
+      request->app = G_APPLICATION (g_object_ref (gtk_window_get_application (GTK_WINDOW (self))));
+      g_weak_ref_init (&request->window, self);
+      g_application_hold (request->app);
+      /* final_meme is only preview resolution; export renders at full size,
+       * from a snapshot, on a worker thread. */
+      meme_export_async (self->template_image, &self->geometry, self->template_source, self->layers,
+                         gtk_toggle_button_get_active(self->cinematic_button),
+                         gtk_toggle_button_get_active(self->deep_fry_button),
+                         self->noise_seed,
+                         gtk_toggle_button_get_active(self->crop_mode_button) ? &crop : NULL,
+                         file, &options, NULL, on_export_finished, request);
   }
+  g_clear_object (&file);
 }
 
 static void on_export_clicked (MyappWindow *self) {
-  if (!self->final_meme) return;
+  if (!self->template_image) return;
   GtkFileDialog *dialog = gtk_file_dialog_new ();
-  gtk_file_dialog_set_initial_name (dialog, "meme.png");
+  g_autofree char *name = g_strconcat ("meme.", meme_export_format_get_extension (adw_combo_row_get_selected (self->export_format_row)), NULL);
+  gtk_file_dialog_set_initial_name (dialog, name);
   gtk_file_dialog_save (dialog, GTK_WINDOW (self), NULL, on_export_response, self);
 }
 
+static void on_export_format_changed (MyappWindow *self) {
+  gtk_widget_set_sensitive (GTK_WIDGET (self->export_quality_row),
+                            adw_combo_row_get_selected (self->export_format_row) != MEME_EXPORT_PNG);
+}
+
 static void on_clear_clicked (MyappWindow *self) {
+  cancel_loads (self);
+  self->document_cancellable = g_cancellable_new ();
   gtk_stack_set_visible_child_name (self->content_stack, "empty");
   g_clear_object (&self->template_image);
+  g_clear_pointer (&self->template_source, g_free);
+  g_clear_pointer (&self->open_template_path, g_free);
+  update_template_actions (self);
   g_clear_object (&self->final_meme);
-  if (self->layers) { meme_layer_list_free (self->layers); self->layers = NULL; }
-  free_history_stack (&self->undo_stack); free_history_stack (&self->redo_stack);
-  self->selected_layer = NULL;
+  meme_compositor_invalidate (self->compositor);
+  meme_layer_stack_clear (self->layers);
+  meme_history_clear (self->history);
+  self->selected_id = 0;
   sync_ui_with_layer(self);
-  gtk_image_clear (self->meme_preview);
+  meme_canvas_set_texture (self->meme_preview, NULL);
+  update_overlay (self);
   gtk_toggle_button_set_active (self->deep_fry_button, FALSE);
   gtk_toggle_button_set_active (self->cinematic_button, FALSE);
   gtk_widget_set_sensitive(GTK_WIDGET(self->crop_mode_button), FALSE);
 }
 
 
+static void myapp_window_dispose (GObject *object) {
+  MyappWindow *self = MYAPP_WINDOW (object);
+  if (self->render_tick_id) {
+    gtk_widget_remove_tick_callback (GTK_WIDGET (self->meme_preview), self->render_tick_id);
+    self->render_tick_id = 0;
+  }
+  cancel_loads (self);
+  if (self->template_monitor) {
+    g_signal_handlers_disconnect_by_data (self->template_monitor, self);
+    g_file_monitor_cancel (self->template_monitor);
+    g_clear_object (&self->template_monitor);
+  }
+  g_clear_handle_id (&self->template_changes_id, g_source_remove);
+  g_debug ("%" G_GUINT64_FORMAT " renders requested, %" G_GUINT64_FORMAT " executed",
+           self->renders_requested, self->renders_executed);
+  G_OBJECT_CLASS (myapp_window_parent_class)->dispose (object);
+}
+
 static void myapp_window_finalize (GObject *object) {
   MyappWindow *self = MYAPP_WINDOW (object);
   g_clear_object (&self->template_image);
+  g_clear_pointer (&self->template_source, g_free);
+  g_clear_pointer (&self->open_template_path, g_free);
   g_clear_object (&self->final_meme);
+  g_clear_pointer (&self->compositor, meme_compositor_free);
   g_clear_object (&self->drag_gesture);
-  if (self->layers) meme_layer_list_free (self->layers);
-  free_history_stack (&self->undo_stack);
-  free_history_stack (&self->redo_stack);
+  g_clear_pointer (&self->history, meme_history_free);
+  g_clear_pointer (&self->layers, meme_layer_stack_free);
+  g_clear_pointer (&self->hit_index, meme_spatial_index_free);
+  g_clear_object (&self->template_selection);
+  g_clear_object (&self->template_list);
+  g_clear_pointer (&self->template_changes, g_hash_table_unref);
   G_OBJECT_CLASS (myapp_window_parent_class)->finalize (object);
 }
 
@@ -604,8 +868,11 @@ static void myapp_window_class_init (MyappWindowClass *klass) {
   GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->dispose = myapp_window_dispose;
   object_class->finalize = myapp_window_finalize;
 
+  g_type_ensure (MEME_TYPE_CANVAS);
+
   gtk_widget_class_set_template_from_resource (widget_class, "/io/github/vani_tty1/memerist/myapp-window.ui");
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, layer_group);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, templates_group);
@@ -617,7 +884,12 @@ static void myapp_window_class_init (MyappWindowClass *klass) {
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, layer_text_entry);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, layer_font_size);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, layer_font_size_row);
+  gtk_widget_class_bind_template_child (widget_class, MyappWindow, layer_auto_fit_row);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, export_button);
+  gtk_widget_class_bind_template_child (widget_class, MyappWindow, export_format_row);
+  gtk_widget_class_bind_template_child (widget_class, MyappWindow, export_quality_row);
+  gtk_widget_class_bind_template_child (widget_class, MyappWindow, export_limit_row);
+  gtk_widget_class_bind_template_child (widget_class, MyappWindow, export_max_size_row);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, load_image_button);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, clear_button);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, add_image_button);
@@ -630,6 +902,8 @@ static void myapp_window_class_init (MyappWindowClass *klass) {
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, layer_rotation_scale);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, blend_mode_row);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, delete_layer_button);
+  gtk_widget_class_bind_template_child (widget_class, MyappWindow, raise_layer_button);
+  gtk_widget_class_bind_template_child (widget_class, MyappWindow, lower_layer_button);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, crop_mode_button);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, rotate_left_button);
   gtk_widget_class_bind_template_child (widget_class, MyappWindow, rotate_right_button);
@@ -654,102 +928,252 @@ is_user_template (const char *path) {
   return g_str_has_prefix (path, user_dir);
 }
 
+typedef struct {
+  GtkPicture *picture;
+  char *path;
+} ThumbnailRequest;
+
 static void
-add_file_to_gallery (MyappWindow *self, const char *full_path) {
-  GtkWidget *picture;
-  if (g_str_has_prefix (full_path, "resource://")) {
-    picture = gtk_picture_new_for_resource (full_path + 11);
-  } else {
-    picture = gtk_picture_new_for_filename (full_path);
+on_thumbnail_loaded (GObject *s, GAsyncResult *r, gpointer d) {
+  ThumbnailRequest *req = d;
+  GdkPixbuf *pixbuf = meme_thumbnail_load_finish (r, NULL);
+  /* Tiles are recycled; only paint it if the tile still shows this path. */
+  if (pixbuf && g_strcmp0 (g_object_get_data (G_OBJECT (req->picture), "template-path"), req->path) == 0) {
+    GdkTexture *texture = gdk_texture_new_for_pixbuf (pixbuf);
+    gtk_picture_set_paintable (req->picture, GDK_PAINTABLE (texture));
+    g_object_unref (texture);
   }
+  g_clear_object (&pixbuf);
+  g_object_unref (req->picture);
+  g_free (req->path);
+  g_free (req);
+}
+
+static void
+on_gallery_setup (GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+  GtkWidget *picture = gtk_picture_new ();
   gtk_picture_set_can_shrink (GTK_PICTURE (picture), TRUE);
   gtk_picture_set_content_fit (GTK_PICTURE (picture), GTK_CONTENT_FIT_CONTAIN);
   gtk_widget_set_size_request (picture, 120, 120);
-  g_object_set_data_full (G_OBJECT (picture), "template-path", g_strdup (full_path), g_free);
-  gtk_flow_box_append (self->template_gallery, picture);
+  gtk_list_item_set_child (item, picture);
 }
 
+/* Thumbnails are only requested for tiles that are actually bound, i.e.
+ * on screen or about to be; scrolling past a tile cancels its request. */
 static void
-scan_directory_for_templates (MyappWindow *self, const char *dir_path) {
+on_gallery_bind (GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+  GtkWidget *picture = gtk_list_item_get_child (item);
+  const char *path = gtk_string_object_get_string (GTK_STRING_OBJECT (gtk_list_item_get_item (item)));
+  GCancellable *cancellable = g_cancellable_new ();
+  ThumbnailRequest *req = g_new0 (ThumbnailRequest, 1);
+
+  g_object_set_data_full (G_OBJECT (picture), "template-path", g_strdup (path), g_free);
+  g_object_set_data_full (G_OBJECT (picture), "thumbnail-cancellable", cancellable, g_object_unref);
+  req->picture = GTK_PICTURE (g_object_ref (picture));
+  req->path = g_strdup (path);
+  meme_thumbnail_load_async (path, cancellable, on_thumbnail_loaded, req);
+}
+
+static void
+on_gallery_unbind (GtkSignalListItemFactory *factory, GtkListItem *item, gpointer user_data) {
+  GtkWidget *picture = gtk_list_item_get_child (item);
+  g_cancellable_cancel (g_object_get_data (G_OBJECT (picture), "thumbnail-cancellable"));
+  g_object_set_data (G_OBJECT (picture), "thumbnail-cancellable", NULL);
+  g_object_set_data (G_OBJECT (picture), "template-path", NULL);
+  gtk_picture_set_paintable (GTK_PICTURE (picture), NULL);
+}
+
+static gboolean
+is_template_file (const char *filename) {
+  return g_str_has_suffix (filename, ".png") || g_str_has_suffix (filename, ".jpg") || g_str_has_suffix (filename, ".jpeg");
+}
+
+static void
+scan_directory_for_templates (GPtrArray *paths, const char *dir_path) {
   GDir *dir = g_dir_open (dir_path, 0, NULL);
   const char *filename;
   if (!dir) return;
   while ((filename = g_dir_read_name (dir)) != NULL) {
-    if (g_str_has_suffix (filename, ".png") || g_str_has_suffix (filename, ".jpg") || g_str_has_suffix (filename, ".jpeg")) {
-      char *full_path = g_build_filename (dir_path, filename, NULL);
-      add_file_to_gallery (self, full_path);
-      g_free (full_path);
+    if (is_template_file (filename)) {
+      g_ptr_array_add (paths, g_build_filename (dir_path, filename, NULL));
     }
   }
   g_dir_close (dir);
 }
 
 static void
-scan_resources_for_templates (MyappWindow *self) {
+scan_resources_for_templates (GPtrArray *paths) {
   GError *error = NULL;
   const char *res_path = "/io/github/vani_tty1/memerist/templates";
   char **files = g_resources_enumerate_children (res_path, 0, &error);
 
   if (files) {
     for (int i = 0; files[i] != NULL; i++) {
-      char *full_uri = g_strdup_printf ("resource://%s/%s", res_path, files[i]);
-      add_file_to_gallery (self, full_uri);
-      g_free (full_uri);
+      g_ptr_array_add (paths, g_strdup_printf ("resource://%s/%s", res_path, files[i]));
     }
     g_strfreev (files);
   }
+  g_clear_error (&error);
 }
 
+/* Replaces the model's contents in one splice; the grid view only creates
+ * and binds tiles for the visible rows. */
 static void
 populate_template_gallery (MyappWindow *self) {
+  GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
   char *user_dir;
-  gtk_flow_box_remove_all(self->template_gallery);
-  
-  scan_resources_for_templates (self);
+
+  scan_resources_for_templates (paths);
   user_dir = get_user_template_dir ();
   g_mkdir_with_parents (user_dir, 0755);
-  scan_directory_for_templates (self, user_dir);
+  scan_directory_for_templates (paths, user_dir);
   g_free (user_dir);
+
+  g_ptr_array_add (paths, NULL);
+  gtk_string_list_splice (self->template_list, 0, g_list_model_get_n_items (G_LIST_MODEL (self->template_list)),
+                          (const char * const *)paths->pdata);
+  g_ptr_array_unref (paths);
 }
 
-static void
-on_template_selected (GtkFlowBox *flowbox, GtkFlowBoxChild *child, MyappWindow *self) {
-  GtkWidget *image;
-  const char *template_path;
-  GError *error = NULL;
+typedef struct {
+  guint position;
+  const char *path;
+} TemplateChange;
 
-  if (!child) { 
-      gtk_widget_set_sensitive (GTK_WIDGET (self->delete_template_button), FALSE); 
-      return; 
-  }
-  
-  image = gtk_flow_box_child_get_child (child);
-  template_path = g_object_get_data (G_OBJECT (image), "template-path");
-  if (!template_path) return;
+static int
+template_change_compare (gconstpointer a, gconstpointer b) {
+  guint pa = ((const TemplateChange *)a)->position, pb = ((const TemplateChange *)b)->position;
+  return pa < pb ? -1 : pa > pb;
+}
 
-  gtk_widget_set_sensitive (GTK_WIDGET (self->delete_template_button), is_user_template (template_path));
-  
-  g_clear_object (&self->template_image);
-  if (self->layers) { meme_layer_list_free (self->layers); self->layers = NULL; }
-  free_history_stack (&self->undo_stack); free_history_stack (&self->redo_stack);
+/* Path -> position + 1 for every tile; the keys belong to the list. */
+static GHashTable *
+template_positions (MyappWindow *self) {
+  GHashTable *positions = g_hash_table_new (g_str_hash, g_str_equal);
+  guint i, n = g_list_model_get_n_items (G_LIST_MODEL (self->template_list));
+  for (i = 0; i < n; i++)
+    g_hash_table_insert (positions, (gpointer)gtk_string_list_get_string (self->template_list, i), GUINT_TO_POINTER (i + 1));
+  return positions;
+}
 
-  if (g_str_has_prefix (template_path, "resource://")) {
-      self->template_image = gdk_pixbuf_new_from_resource (template_path + 11, &error);
-  } else {
-      self->template_image = gdk_pixbuf_new_from_file (template_path, &error);
+/* Reconciles each touched path with the disk: new files are appended in a
+ * single splice, vanished ones removed, and changed ones replaced in place
+ * so their tile rebinds and picks up a fresh thumbnail. Positions come
+ * from one pass over the list, and adjacent replacements and removals go
+ * in one splice per run, so a batch costs O(n + m) rather than a scan per
+ * path. */
+static gboolean
+flush_template_changes (gpointer data) {
+  MyappWindow *self = MYAPP_WINDOW (data);
+  GArray *changed = g_array_new (FALSE, FALSE, sizeof (TemplateChange));
+  GArray *removed = g_array_new (FALSE, FALSE, sizeof (TemplateChange));
+  GPtrArray *added = g_ptr_array_new ();
+  GHashTable *positions;
+  GHashTableIter iter;
+  gpointer key;
+  guint i, j;
+
+  g_clear_handle_id (&self->template_changes_id, g_source_remove);
+  positions = template_positions (self);
+  g_hash_table_iter_init (&iter, self->template_changes);
+  while (g_hash_table_iter_next (&iter, &key, NULL)) {
+    guint slot = GPOINTER_TO_UINT (g_hash_table_lookup (positions, key));
+    gboolean exists = g_file_test (key, G_FILE_TEST_IS_REGULAR);
+
+    if (slot == 0) {
+      if (exists) g_ptr_array_add (added, key);
+    } else {
+      TemplateChange change = { slot - 1, key };
+      g_array_append_val (exists ? changed : removed, change);
+    }
+  }
+  g_hash_table_unref (positions);
+  g_array_sort (changed, template_change_compare);
+  g_array_sort (removed, template_change_compare);
+
+  /* Replacing moves nothing, so runs can go in any order. */
+  for (i = 0; i < changed->len; i = j) {
+    GPtrArray *run = g_ptr_array_new ();
+    guint start = g_array_index (changed, TemplateChange, i).position;
+    for (j = i; j < changed->len && g_array_index (changed, TemplateChange, j).position == start + (j - i); j++)
+      g_ptr_array_add (run, (gpointer)g_array_index (changed, TemplateChange, j).path);
+    g_ptr_array_add (run, NULL);
+    gtk_string_list_splice (self->template_list, start, j - i, (const char * const *)run->pdata);
+    g_ptr_array_unref (run);
+  }
+  /* Removed from the bottom up, so the positions above stay valid. */
+  for (j = removed->len; j > 0; j = i) {
+    for (i = j - 1; i > 0 && g_array_index (removed, TemplateChange, i - 1).position + 1 ==
+                             g_array_index (removed, TemplateChange, i).position; i--);
+    gtk_string_list_splice (self->template_list, g_array_index (removed, TemplateChange, i).position, j - i, NULL);
+  }
+  if (added->len > 0) {
+    g_ptr_array_add (added, NULL);
+    gtk_string_list_splice (self->template_list, g_list_model_get_n_items (G_LIST_MODEL (self->template_list)), 0,
+                            (const char * const *)added->pdata);
   }
+  g_array_unref (changed);
+  g_array_unref (removed);
+  g_ptr_array_unref (added);
+  g_hash_table_remove_all (self->template_changes);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+queue_template_change (MyappWindow *self, GFile *file) {
+  g_autofree char *basename = g_file_get_basename (file);
+  g_autofree char *path = g_file_get_path (file);
+  gint64 now = g_get_monotonic_time ();
+
+  /* rsync's temporary files and moves out of the directory end up here too. */
+  if (!path || !is_template_file (basename) || !is_user_template (path)) return;
+  g_hash_table_add (self->template_changes, g_steal_pointer (&path));
+
+  if (self->template_changes_id == 0) self->template_changes_since = now;
+  else if (now - self->template_changes_since >= TEMPLATE_CHANGE_MAX_DELAY_MS * 1000) return;
+  g_clear_handle_id (&self->template_changes_id, g_source_remove);
+  self->template_changes_id = g_timeout_add (TEMPLATE_CHANGE_DELAY_MS, flush_template_changes, self);
+}
 
-  if (self->template_image) {
-      gtk_stack_set_visible_child_name (self->content_stack, "content");
-      gtk_widget_set_sensitive (GTK_WIDGET (self->add_text_button), TRUE);
-      gtk_widget_set_sensitive (GTK_WIDGET (self->export_button), TRUE);
-      gtk_widget_set_sensitive (GTK_WIDGET (self->clear_button), TRUE);
-      gtk_widget_set_sensitive (GTK_WIDGET (self->add_image_button), TRUE);
-      gtk_widget_set_sensitive (GTK_WIDGET (self->deep_fry_button), TRUE);
-      gtk_widget_set_sensitive (GTK_WIDGET (self->cinematic_button), TRUE);
-      gtk_widget_set_sensitive(GTK_WIDGET(self->crop_mode_button), TRUE);
-      render_meme (self);
+static void
+on_template_dir_changed (GFileMonitor *monitor, GFile *file, GFile *other_file,
+                         GFileMonitorEvent event, MyappWindow *self) {
+  if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED) return;
+  queue_template_change (self, file);
+  if (other_file) queue_template_change (self, other_file);
+}
+
+static void
+watch_template_dir (MyappWindow *self) {
+  g_autofree char *user_dir = get_user_template_dir ();
+  GFile *dir = g_file_new_for_path (user_dir);
+  GError *error = NULL;
+
+  self->template_monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+  if (self->template_monitor)
+    g_signal_connect (self->template_monitor, "changed", G_CALLBACK (on_template_dir_changed), self);
+  else {
+    g_warning ("Cannot watch %s: %s", user_dir, error->message);
+    g_error_free (error);
   }
+  g_object_unref (dir);
+}
+
+/* Delete follows the open template, not the grid's selection: with
+ * single-click activation the selection tracks whatever tile the pointer
+ * is over. */
+static void
+update_template_actions (MyappWindow *self) {
+  gtk_widget_set_sensitive (GTK_WIDGET (self->delete_template_button),
+                            self->open_template_path && is_user_template (self->open_template_path));
+}
+
+static void
+on_template_activated (GtkGridView *view, guint position, MyappWindow *self) {
+  GtkStringObject *item = g_list_model_get_item (G_LIST_MODEL (self->template_list), position);
+  if (!item) return;
+  open_template (self, gtk_string_object_get_string (item));
+  g_object_unref (item);
 }
 
 static void
@@ -769,8 +1193,13 @@ on_import_template_response (GObject *s, GAsyncResult *r, gpointer d) {
   dest_path = g_build_filename (user_dir_path, filename, NULL);
   dest_file = g_file_new_for_path (dest_path);
 
+  /* Applied right away rather than waiting for the monitor, which then
+   * finds nothing left to do. */
   if (g_file_copy (source_file, dest_file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &error)) {
-    add_file_to_gallery (self, dest_path);
+    queue_template_change (self, dest_file);
+    flush_template_changes (self);
+  } else {
+    g_error_free (error);
   }
   g_free (filename); g_free (user_dir_path); g_free (dest_path);
   g_object_unref (source_file); g_object_unref (dest_file);
@@ -788,16 +1217,13 @@ on_delete_confirm_response (GObject *s, GAsyncResult *r, gpointer d) {
   GtkAlertDialog *dialog = GTK_ALERT_DIALOG (s);
   MyappWindow *self = MYAPP_WINDOW (d);
   if (gtk_alert_dialog_choose_finish (dialog, r, NULL) == 1) {
-    GList *selected = gtk_flow_box_get_selected_children (self->template_gallery);
-    if (selected) {
-      GtkFlowBoxChild *child = selected->data;
-      GtkWidget *image = gtk_flow_box_child_get_child (child);
-      const char *path = g_object_get_data (G_OBJECT (image), "template-path");
-      if (g_unlink (path) == 0) {
-        gtk_flow_box_remove (self->template_gallery, GTK_WIDGET (child));
-        on_clear_clicked (self);
-      }
-      g_list_free (selected);
+    const char *path = g_object_get_data (G_OBJECT (dialog), "template-path");
+    if (path && is_user_template (path) && g_unlink (path) == 0) {
+      GFile *file = g_file_new_for_path (path);
+      queue_template_change (self, file);
+      g_object_unref (file);
+      flush_template_changes (self);
+      if (g_strcmp0 (path, self->open_template_path) == 0) on_clear_clicked (self);
     }
   }
 }
@@ -807,6 +1233,8 @@ on_delete_template_clicked (MyappWindow *self) {
   GtkAlertDialog *dialog = gtk_alert_dialog_new ("Delete this template?");
   gtk_alert_dialog_set_buttons (dialog, (const char *[]) {"Cancel", "Delete", NULL});
   gtk_alert_dialog_set_default_button (dialog, 1);
+  /* Pinned now, in case another template is opened while the dialog is up. */
+  g_object_set_data_full (G_OBJECT (dialog), "template-path", g_strdup (self->open_template_path), g_free);
   gtk_alert_dialog_choose (dialog, GTK_WINDOW (self), NULL, on_delete_confirm_response, self);
 }
 
@@ -829,7 +1257,23 @@ static gboolean on_key_pressed (GtkEventControllerKey *controller, guint keyval,
 
 static void myapp_window_init (MyappWindow *self) {
   gtk_widget_init_template (GTK_WIDGET (self));
-  self->layers = NULL; self->undo_stack = NULL; self->redo_stack = NULL;
+  self->layers = meme_layer_stack_new ();
+  self->hit_index = meme_spatial_index_new ();
+  self->document_cancellable = g_cancellable_new ();
+  self->history = meme_history_new (MEME_HISTORY_DEFAULT_BUDGET);
+  self->compositor = meme_compositor_new ();
+
+  GtkListItemFactory *factory = gtk_signal_list_item_factory_new ();
+  g_signal_connect (factory, "setup", G_CALLBACK (on_gallery_setup), NULL);
+  g_signal_connect (factory, "bind", G_CALLBACK (on_gallery_bind), NULL);
+  g_signal_connect (factory, "unbind", G_CALLBACK (on_gallery_unbind), NULL);
+  self->template_list = gtk_string_list_new (NULL);
+  self->template_selection = gtk_single_selection_new (G_LIST_MODEL (g_object_ref (self->template_list)));
+  gtk_single_selection_set_autoselect (self->template_selection, FALSE);
+  gtk_single_selection_set_can_unselect (self->template_selection, TRUE);
+  gtk_grid_view_set_model (self->template_gallery, GTK_SELECTION_MODEL (self->template_selection));
+  gtk_grid_view_set_factory (self->template_gallery, factory);
+  g_object_unref (factory);
 
   
   g_signal_connect (self->rotate_left_button, "clicked", G_CALLBACK (on_rotate_clicked), self);
@@ -844,16 +1288,18 @@ static void myapp_window_init (MyappWindow *self) {
   g_signal_connect_swapped (self->add_text_button, "clicked", G_CALLBACK (on_add_text_clicked), self);
   g_signal_connect_swapped (self->layer_text_entry, "changed", G_CALLBACK (on_layer_text_changed), self);
   g_signal_connect_swapped (self->layer_font_size, "value-changed", G_CALLBACK (on_layer_text_changed), self);
+  g_signal_connect_swapped (self->layer_auto_fit_row, "notify::active", G_CALLBACK (on_auto_fit_changed), self);
   
   g_signal_connect_swapped (self->load_image_button, "clicked", G_CALLBACK (on_load_image_clicked), self);
   g_signal_connect_swapped (self->clear_button, "clicked", G_CALLBACK (on_clear_clicked), self);
   g_signal_connect_swapped (self->add_image_button, "clicked", G_CALLBACK (on_add_image_clicked), self);
   g_signal_connect_swapped (self->export_button, "clicked", G_CALLBACK (on_export_clicked), self);
+  g_signal_connect_swapped (self->export_format_row, "notify::selected", G_CALLBACK (on_export_format_changed), self);
   
 
   g_signal_connect_swapped (self->import_template_button, "clicked", G_CALLBACK (on_import_template_clicked), self);
   g_signal_connect_swapped (self->delete_template_button, "clicked", G_CALLBACK (on_delete_template_clicked), self);
-  g_signal_connect (self->template_gallery, "child-activated", G_CALLBACK (on_template_selected), self);
+  g_signal_connect (self->template_gallery, "activate", G_CALLBACK (on_template_activated), self);
 
   g_signal_connect (self->deep_fry_button, "toggled", G_CALLBACK (on_deep_fry_toggled), self);
   g_signal_connect_swapped (self->cinematic_button, "toggled", G_CALLBACK (on_text_changed), self);
@@ -862,6 +1308,8 @@ static void myapp_window_init (MyappWindow *self) {
   g_signal_connect_swapped (self->layer_rotation_scale, "value-changed", G_CALLBACK (on_layer_control_changed), self);
   g_signal_connect_swapped (self->blend_mode_row, "notify::selected", G_CALLBACK (on_layer_control_changed), self);
   g_signal_connect_swapped (self->delete_layer_button, "clicked", G_CALLBACK (on_delete_layer_clicked), self);
+  g_signal_connect (self->raise_layer_button, "clicked", G_CALLBACK (on_restack_layer_clicked), self);
+  g_signal_connect (self->lower_layer_button, "clicked", G_CALLBACK (on_restack_layer_clicked), self);
 
   self->drag_gesture = GTK_GESTURE_DRAG (gtk_gesture_drag_new ());
   gtk_widget_add_controller (GTK_WIDGET (self->meme_preview), GTK_EVENT_CONTROLLER (self->drag_gesture));
@@ -869,6 +1317,9 @@ static void myapp_window_init (MyappWindow *self) {
   g_signal_connect (self->drag_gesture, "drag-update", G_CALLBACK (on_drag_update), self);
   g_signal_connect (self->drag_gesture, "drag-end", G_CALLBACK (on_drag_end), self);
 
+  g_signal_connect_swapped (self->meme_preview, "viewport-changed", G_CALLBACK (on_text_changed), self);
+  g_signal_connect_swapped (self->meme_preview, "notify::scale-factor", G_CALLBACK (on_text_changed), self);
+
   GtkEventController *motion = gtk_event_controller_motion_new ();
   gtk_widget_add_controller (GTK_WIDGET (self->meme_preview), motion);
   g_signal_connect (motion, "motion", G_CALLBACK (on_mouse_move), self);
@@ -877,5 +1328,7 @@ static void myapp_window_init (MyappWindow *self) {
   g_signal_connect (key_controller, "key-pressed", G_CALLBACK (on_key_pressed), self);
   gtk_widget_add_controller (GTK_WIDGET (self), key_controller);
   
+  self->template_changes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   populate_template_gallery (self);
+  watch_template_dir (self);
 }
\ No newline at end of file